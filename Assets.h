@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+
+// 编译进程序的静态资源, 由tools/AssetGen根据assets/目录生成AssetData.cc
+// 每项带有预先生成的头部(ETag, Content-Type, Content-Length)和body, 连续存放在.rodata中,
+// 发送时和通用头部一起直接放进输出队列, 不访问文件系统
+struct Asset {
+    std::string_view path;      // 不含开头的'/'
+    std::string_view etag;
+    std::string_view response;  // 头部(含结尾空行)和body
+    size_t headerLength;        // HEAD请求只发送response的前headerLength字节
+    std::string_view gzipEtag;      // 压缩版本是不同的表示, 使用不同的强校验值
+    std::string_view gzipResponse;  // 预压缩的版本, 压缩无收益时为空
+    size_t gzipHeaderLength;
+};
+
+// 路径索引在编译期用线性探测建好
+constexpr uint32_t assetHash(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (char c : s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+template <size_t N>
+struct AssetIndex {
+    static constexpr size_t kSize = [] {
+        size_t size = 8;
+        while (size < 2 * N) size <<= 1;
+        return size;
+    }();
+    int16_t slot[kSize];
+};
+
+template <size_t N>
+constexpr AssetIndex<N> buildAssetIndex(const Asset (&assets)[N]) {
+    AssetIndex<N> index = {};
+    for (size_t i = 0; i < index.kSize; ++i) index.slot[i] = -1;
+    for (size_t i = 0; i < N; ++i) {
+        size_t h = assetHash(assets[i].path) & (index.kSize - 1);
+        while (index.slot[h] >= 0) h = (h + 1) & (index.kSize - 1);
+        index.slot[h] = static_cast<int16_t>(i);
+    }
+    return index;
+}
+
+template <size_t N>
+const Asset *lookupAsset(const Asset (&assets)[N], const AssetIndex<N> &index,
+                         std::string_view path) {
+    for (size_t h = assetHash(path) & (index.kSize - 1); index.slot[h] >= 0;
+         h = (h + 1) & (index.kSize - 1))
+        if (assets[index.slot[h]].path == path) return &assets[index.slot[h]];
+    return NULL;
+}
+
+// 不存在时返回NULL
+const Asset *findAsset(std::string_view path);
@@ -8,15 +8,17 @@
 
 #include "Epoll.h"
 #include "EventLoop.h"
+#include "HttpData.h"
+#include "Server.h"
 #include "Util.h"
 
 using namespace std;
 
 Channel::Channel(EventLoop *loop)
-    : loop_(loop), events_(0), lastEvents_(0), fd_(0) {}
+    : loop_(loop), fd_(0), events_(0), lastEvents_(0), kind_(kCallback), owner_(NULL) {}
 
 Channel::Channel(EventLoop *loop, int fd)
-    : loop_(loop), fd_(fd), events_(0), lastEvents_(0) {}
+    : loop_(loop), fd_(fd), events_(0), lastEvents_(0), kind_(kCallback), owner_(NULL) {}
 
 Channel::~Channel() {
   // loop_->poller_->epoll_del(fd, events_);
@@ -26,20 +28,53 @@ Channel::~Channel() {
 int Channel::getFd() { return fd_; }
 void Channel::setFd(int fd) { fd_ = fd; }
 
-void Channel::handleRead() {
-    if (readHandler_) {
-        readHandler_();
-    }
+Channel::Callbacks &Channel::callbacks() {
+    if (!callbacks_) callbacks_.reset(new Callbacks);
+    kind_ = kCallback;
+    return *callbacks_;
 }
 
-void Channel::handleWrite() {
-    if (writeHandler_) {
-        writeHandler_();
-    }
+void Channel::setReadHandler(CallBack &&readHandler) {
+    callbacks().readHandler = std::move(readHandler);
 }
 
-void Channel::handleConn() {
-    if (connHandler_) {
-        connHandler_();
+void Channel::setWriteHandler(CallBack &&writeHandler) {
+    callbacks().writeHandler = std::move(writeHandler);
+}
+
+void Channel::setErrorHandler(CallBack &&errorHandler) {
+    callbacks().errorHandler = std::move(errorHandler);
+}
+
+void Channel::setConnHandler(CallBack &&connHandler) {
+    callbacks().connHandler = std::move(connHandler);
+}
+
+void Channel::handleEvents() {
+    switch (kind_) {
+        case kConnection:
+            dispatch<HttpData, &HttpData::handleRead, &HttpData::handleWrite,
+                     &HttpData::handleConn, &HttpData::handleReset>(
+                static_cast<HttpData *>(owner_));
+            break;
+        case kWakeup:
+            dispatch<EventLoop, &EventLoop::handleRead, nullptr, &EventLoop::handleConn,
+                     nullptr>(static_cast<EventLoop *>(owner_));
+            break;
+        case kAcceptor:
+            dispatch<Server, &Server::handNewConn, nullptr, &Server::handThisConn, nullptr>(
+                static_cast<Server *>(owner_));
+            break;
+        case kTimer:
+            dispatch<Server, &Server::handleOverloadTimer, nullptr, &Server::handleTimerConn,
+                     nullptr>(static_cast<Server *>(owner_));
+            break;
+        case kCallback:
+            if (callbacks_)
+                dispatch<Callbacks, &Callbacks::read, &Callbacks::write, &Callbacks::conn,
+                         &Callbacks::error>(callbacks_.get());
+            else
+                events_ = 0;
+            break;
     }
-}
\ No newline at end of file
+}
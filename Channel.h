@@ -1,36 +1,54 @@
 #pragma once
 #include <sys/epoll.h>
-#include <sys/epoll.h>
 #include <functional>
 #include <memory>
-#include <string>
-#include <unordered_map>
-#include "Timer.h"
 
 class EventLoop;
 class HttpData;
+class Server;
 
 class Channel {
-private:
+public:
     typedef std::function<void()> CallBack;
+    // 事件交给谁处理. 库内已知的几类Channel按类型直接调用成员函数(见handleEvents),
+    // 没有std::function和bind的间接调用; 其它用户代码使用set*Handler设置回调
+    enum Kind {
+        kCallback,    // set*Handler设置的回调
+        kConnection,  // HttpData
+        kWakeup,      // EventLoop的eventfd
+        kAcceptor,    // Server的监听socket
+        kTimer,       // Server停止accept期间的timerfd
+    };
+
+private:
     EventLoop *loop_;
     int fd_;
     __uint32_t events_;
     __uint32_t revents_;
     __uint32_t lastEvents_;
+    Kind kind_;
+    // 按kind_处理事件的对象, 不持有引用
+    void *owner_;
 
-    // 方便找到上层持有该Channel的对象
-    std::weak_ptr<HttpData> holder_;
-
-private:
-    int parse_URI();
-    int parse_Headers();
-    int analysisRequest();
+    struct Callbacks {
+        CallBack readHandler;
+        CallBack writeHandler;
+        CallBack errorHandler;
+        CallBack connHandler;
+        // 作为dispatch的owner, 没有设置的回调不调用
+        void read() { if (readHandler) readHandler(); }
+        void write() { if (writeHandler) writeHandler(); }
+        void error() { if (errorHandler) errorHandler(); }
+        void conn() { if (connHandler) connHandler(); }
+    };
+    // 只有kCallback用到, 第一次设置回调时分配, 连接的Channel不占这部分内存
+    std::unique_ptr<Callbacks> callbacks_;
 
-    CallBack readHandler_;
-    CallBack writeHandler_;
-    CallBack errorHandler_;
-    CallBack connHandler_;
+    Callbacks &callbacks();
+    void setOwner(Kind kind, void *owner) {
+        kind_ = kind;
+        owner_ = owner;
+    }
 
 public:
     Channel(EventLoop *loop);
@@ -39,43 +57,43 @@ public:
     int getFd();
     void setFd(int fd);
 
-    void setHolder(std::shared_ptr<HttpData> holder) { holder_ = holder; }
-    std::shared_ptr<HttpData> getHolder() {
-        std::shared_ptr<HttpData> ret(holder_.lock());
-        return ret;
+    void setHolder(HttpData *conn) { setOwner(kConnection, conn); }
+    void setWakeup(EventLoop *loop) { setOwner(kWakeup, loop); }
+    void setAcceptor(Server *server) { setOwner(kAcceptor, server); }
+    void setTimer(Server *server) { setOwner(kTimer, server); }
+    Kind kind() const { return kind_; }
+    // 方便找到上层持有该Channel的连接; 不属于连接的Channel为NULL
+    HttpData *getHolder() {
+        return kind_ == kConnection ? static_cast<HttpData *>(owner_) : NULL;
     }
 
-    void setReadHandler(CallBack &&readHandler) { readHandler_ = readHandler; }
-    void setWriteHandler(CallBack &&writeHandler) {
-        writeHandler_ = writeHandler;
-    }
-    void setErrorHandler(CallBack &&errorHandler) {
-        errorHandler_ = errorHandler;
-    }
-    void setConnHandler(CallBack &&connHandler) { connHandler_ = connHandler; }
+    void setReadHandler(CallBack &&readHandler);
+    void setWriteHandler(CallBack &&writeHandler);
+    void setErrorHandler(CallBack &&errorHandler);
+    void setConnHandler(CallBack &&connHandler);
+
+    void handleEvents();
 
-    void handleEvents() {
+    // 按revents_依次调用owner的成员函数, 成员函数指针是模板参数, 调用是直接的;
+    // 没有对应处理的事件传nullptr. handleEvents对每种Kind各实例化一次
+    template <typename T, void (T::*Read)(), void (T::*Write)(), void (T::*Conn)(),
+              void (T::*Error)()>
+    void dispatch(T *owner) {
         events_ = 0;
-        if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN)) {
+        if (((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN)) || (revents_ & EPOLLERR)) {
+            // 对端已经关闭且没有可读的数据, 或者出错
+            if constexpr (Error != nullptr) (owner->*Error)();
             events_ = 0;
             return;
         }
-        if (revents_ & EPOLLERR) {
-        if (errorHandler_) errorHandler_();
-            events_ = 0;
-            return;
+        if constexpr (Read != nullptr) {
+            if (revents_ & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) (owner->*Read)();
         }
-        if (revents_ & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) {
-            handleRead();
+        if constexpr (Write != nullptr) {
+            if (revents_ & EPOLLOUT) (owner->*Write)();
         }
-        if (revents_ & EPOLLOUT) {
-            handleWrite();
-        }
-        handleConn();
+        if constexpr (Conn != nullptr) (owner->*Conn)();
     }
-    void handleRead();
-    void handleWrite();
-    void handleConn();
 
     void setRevents(__uint32_t ev) { revents_ = ev; }
 
@@ -90,5 +108,3 @@ public:
 
     __uint32_t getLastEvents() { return lastEvents_; }
 };
-
-typedef std::shared_ptr<Channel> SP_Channel;
\ No newline at end of file
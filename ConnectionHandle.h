@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+
+class EventLoop;
+class HttpData;
+
+// 其它线程中的对象, 或者可能比连接活得久的对象(BodySink, ResponseWriter)用句柄引用连接,
+// 不持有引用计数; 回到连接的IO线程后查找, 连接已经关闭或描述符已被新的连接复用时得到NULL
+struct ConnectionHandle {
+    EventLoop *loop;
+    int fd;
+    uint64_t id;
+    // 只能在loop的线程调用
+    HttpData *get() const;
+};
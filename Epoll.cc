@@ -18,100 +18,85 @@ using namespace std;
 const int EVENTSNUM = 4096;
 const int EPOLLWAIT_TIME = 10000;
 
-typedef shared_ptr<Channel> SP_Channel;
-
 Epoll::Epoll() : epollFd_(epoll_create1(EPOLL_CLOEXEC)), events_(EVENTSNUM) {
   assert(epollFd_ > 0);
 }
 Epoll::~Epoll() {}
 
 // 注册新描述符
-void Epoll::epoll_add(SP_Channel request, int timeout) {
+void Epoll::epoll_add(Channel *request, int timeout) {
     int fd = request->getFd();
-    if (timeout > 0) {
-        add_timer(request, timeout);
-        fd2http_[fd] = request->getHolder();
-    }
+    fd2http_[fd] = Ref<HttpData>(request->getHolder());
+    if (timeout > 0) add_timer(request, timeout);
     struct epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = request;
     event.events = request->getEvents();
 
     request->EqualAndUpdateLastEvents();
 
-    fd2chan_[fd] = request;
     if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
         perror("epoll_add error");
-        fd2chan_[fd].reset();
+        fd2http_[fd].reset();
     }
 }
 
 // 修改描述符状态
-void Epoll::epoll_mod(SP_Channel request, int timeout) {
+void Epoll::epoll_mod(Channel *request, int timeout) {
     if (timeout > 0) add_timer(request, timeout);
     int fd = request->getFd();
     if (!request->EqualAndUpdateLastEvents()) {
         struct epoll_event event;
-        event.data.fd = fd;
+        event.data.ptr = request;
         event.events = request->getEvents();
         if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event) < 0) {
         perror("epoll_mod error");
-        fd2chan_[fd].reset();
         }
     }
 }
 
 // 从epoll中删除描述符
-void Epoll::epoll_del(SP_Channel request) {
+void Epoll::epoll_del(Channel *request) {
     int fd = request->getFd();
     struct epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = request;
     event.events = request->getLastEvents();
     // event.events = 0;
     // request->EqualAndUpdateLastEvents()
     if (epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &event) < 0) {
         perror("epoll_del error");
     }
-    fd2chan_[fd].reset();
+    // 可能是连接的最后一个引用, 放在最后
     fd2http_[fd].reset();
 }
 
 // 返回活跃事件数
-std::vector<SP_Channel> Epoll::poll() {
-    while (true) {
-        int event_count =
-            epoll_wait(epollFd_, &*events_.begin(), events_.size(), EPOLLWAIT_TIME);
-        if (event_count < 0) perror("epoll wait error");
-        std::vector<SP_Channel> req_data = getEventsRequest(event_count);
-        if (req_data.size() > 0) return req_data;
-    }
+void Epoll::poll(std::vector<Channel *> &active, bool block) {
+    // 空闲的线程也要按时处理超时, 例如连上后一直不发数据的连接
+    int timeout = block ? timerManager_.nextTimeout(EPOLLWAIT_TIME) : 0;
+    int event_count = epoll_wait(epollFd_, &*events_.begin(), events_.size(), timeout);
+    if (event_count < 0 && errno != EINTR) perror("epoll wait error");
+    getEventsRequest(event_count, active);
 }
 
 void Epoll::handleExpired() { timerManager_.handleExpiredEvent(); }
 
 // 分发处理函数
-std::vector<SP_Channel> Epoll::getEventsRequest(int events_num) {
-    std::vector<SP_Channel> req_data;
+void Epoll::getEventsRequest(int events_num, std::vector<Channel *> &active) {
     for (int i = 0; i < events_num; ++i) {
-        // 获取有事件产生的描述符
-        int fd = events_[i].data.fd;
-
-        SP_Channel cur_req = fd2chan_[fd];
-
-        if (cur_req) {
+        // 注册时data.ptr为Channel本身, 不需要再按描述符查表.
+        // Channel在epoll_del之后才会析构, 一次poll返回的同一批事件中,
+        // 处理一个连接的事件不会关闭其它连接, 所以这里取到的Channel在分发时都还有效
+        Channel *cur_req = static_cast<Channel *>(events_[i].data.ptr);
         cur_req->setRevents(events_[i].events);
         cur_req->setEvents(0);
         // 加入线程池之前将Timer和request分离
         // cur_req->seperateTimer();
-        req_data.push_back(cur_req);
-        } else {
-        LOG << "SP cur_req is invalid";
-        }
+        active.push_back(cur_req);
     }
-    return req_data;
 }
 
-void Epoll::add_timer(SP_Channel request_data, int timeout) {
-    shared_ptr<HttpData> t = request_data->getHolder();
+void Epoll::add_timer(Channel *request_data, int timeout) {
+    HttpData *t = request_data->getHolder();
     if (t)
         timerManager_.addTimer(t, timeout);
     else
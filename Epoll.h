@@ -5,26 +5,35 @@
 #include <vector>
 #include "Channel.h"
 #include "HttpData.h"
+#include "Policy.h"
+#include "Ref.h"
 #include "Timer.h"
 
 class Epoll {
 public:
     Epoll();
     ~Epoll();
-    void epoll_add(SP_Channel request, int timeout);
-    void epoll_mod(SP_Channel request, int timeout);
-    void epoll_del(SP_Channel request);
-    std::vector<std::shared_ptr<Channel>> poll();
-    std::vector<std::shared_ptr<Channel>> getEventsRequest(int events_num);
-    void add_timer(std::shared_ptr<Channel> request_data, int timeout);
+    // 属于连接的Channel注册后由fd2http_持有连接的一个引用, epoll_del时释放
+    void epoll_add(Channel *request, int timeout);
+    void epoll_mod(Channel *request, int timeout);
+    void epoll_del(Channel *request);
+    // 把有事件的Channel放进active; 阻塞时最多等到下一个定时器到期,
+    // block为false时不等待, 没有事件也立即返回
+    void poll(std::vector<Channel *> &active, bool block = true);
+    void getEventsRequest(int events_num, std::vector<Channel *> &active);
+    void add_timer(Channel *request_data, int timeout);
+    // 已经注册的连接, 没有时返回NULL
+    HttpData *getHolder(int fd) const {
+        return fd >= 0 && fd < MAXFDS ? fd2http_[fd].get() : NULL;
+    }
     int getEpollFd() { return epollFd_; }
     void handleExpired();
+    int nextTimeout(int limit) { return timerManager_.nextTimeout(limit); }
 
 private:
     static const int MAXFDS = 100000;
     int epollFd_;
     std::vector<epoll_event> events_;
-    std::shared_ptr<Channel> fd2chan_[MAXFDS];
-    std::shared_ptr<HttpData> fd2http_[MAXFDS];
-    TimerManager timerManager_;
+    Ref<HttpData> fd2http_[MAXFDS];
+    ServerPolicy::TimerQueue timerManager_;
 };
\ No newline at end of file
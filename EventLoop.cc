@@ -2,13 +2,17 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <iostream>
+#include <iterator>
 #include "Util.h"
 #include "Logging.h"
+#include "Metrics.h"
 
 using namespace std;
 
 __thread EventLoop* t_loopInThisThread = 0;
 
+const int DEFAULT_FUNCTOR_BUDGET = 1000;  // us
+
 int createEventfd() {
     int evtfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
     if (evtfd < 0) {
@@ -20,13 +24,20 @@ int createEventfd() {
 
 EventLoop::EventLoop()
     : looping_(false),
-      poller_(new Epoll()),
+      poller_(new ServerPolicy::Poller()),
       wakeupFd_(createEventfd()),
       quit_(false),
       eventHandling_(false),
       callingPendingFunctors_(false),
+      functorsDeferred_(false),
+      functorBudgetUs_(DEFAULT_FUNCTOR_BUDGET),
+      polling_(false),
+      loadUs_(0),
       threadId_(CurrentThread::tid()),
-      pwakeupChannel_(new Channel(this, wakeupFd_)) {
+      pwakeupChannel_(new Channel(this, wakeupFd_)),
+      connectionIds_(0),
+      fileLoader_(NULL),
+      now_(::time(NULL)) {
     if (t_loopInThisThread) {
         // LOG << "Another EventLoop " << t_loopInThisThread << " exists in this
         // thread " << threadId_;
@@ -35,15 +46,14 @@ EventLoop::EventLoop()
     }
     // pwakeupChannel_->setEvents(EPOLLIN | EPOLLET | EPOLLONESHOT);
     pwakeupChannel_->setEvents(EPOLLIN | EPOLLET);
-    pwakeupChannel_->setReadHandler(bind(&EventLoop::handleRead, this));
-    pwakeupChannel_->setConnHandler(bind(&EventLoop::handleConn, this));
-    poller_->epoll_add(pwakeupChannel_, 0);
+    pwakeupChannel_->setWakeup(this);
+    poller_->epoll_add(pwakeupChannel_.get(), 0);
 }
 
 void EventLoop::handleConn() {
     // poller_->epoll_mod(wakeupFd_, pwakeupChannel_, (EPOLLIN | EPOLLET |
     // EPOLLONESHOT), 0);
-    updatePoller(pwakeupChannel_, 0);
+    updatePoller(pwakeupChannel_.get(), 0);
 }
 
 EventLoop::~EventLoop() {
@@ -79,8 +89,10 @@ void EventLoop::runInLoop(Functor&& cb) {
 }
 
 void EventLoop::queueInLoop(Functor&& cb) {
+    // 单线程配置的锁什么也不做
+    assert(ServerPolicy::kMultiThread || isInLoopThread());
     {
-      MutexLockGuard lock(mutex_);
+      LockGuard<ServerPolicy::Mutex> lock(mutex_);
       pendingFunctors_.emplace_back(std::move(cb));
     }
 
@@ -93,33 +105,77 @@ void EventLoop::loop() {
     looping_ = true;
     quit_ = false;
     // LOG_TRACE << "EventLoop " << this << " start looping";
-    std::vector<SP_Channel> ret;
+    std::vector<Channel*> ret;
     while (!quit_) {
         // cout << "doing" << endl;
         ret.clear();
-        ret = poller_->poll();
+        // 还有没读完的连接或没执行完的回调时只检查一下新的事件
+        bool block = readyQueue_.empty() && !functorsDeferred_;
+        if (block) polling_.store(true, memory_order_relaxed);
+        poller_->poll(ret, block);
+        polling_.store(false, memory_order_relaxed);
+        int64_t start = monotonicMicros();
+        now_ = ::time(NULL);
         eventHandling_ = true;
-        for (auto& it : ret) it->handleEvents();
+        for (Channel* channel : ret) {
+            // 处理过程中连接可能关闭并从poller中移除, 处理完之前不能析构
+            Ref<HttpData> guard(channel->getHolder());
+            channel->handleEvents();
+        }
         eventHandling_ = false;
+        doReadyQueue();
         doPendingFunctors();
         poller_->handleExpired();
+        int elapsed = static_cast<int>(monotonicMicros() - start);
+        histogramObserve(H_LOOP_ITERATION, elapsed);
+        int load = loadUs_.load(memory_order_relaxed);
+        loadUs_.store(load + (elapsed - load) / 8, memory_order_relaxed);
     }
     looping_ = false;
 }
 
+// 只处理上一轮排进来的连接, 本轮再次用完额度的排到下一轮
+void EventLoop::doReadyQueue() {
+    if (readyQueue_.empty()) return;
+    std::vector<Functor> ready;
+    ready.swap(readyQueue_);
+    for (size_t i = 0; i < ready.size(); ++i) ready[i]();
+}
+
 void EventLoop::doPendingFunctors() {
     std::vector<Functor> functors;
     callingPendingFunctors_ = true;
+    functorsDeferred_ = false;
 
     {
-      MutexLockGuard lock(mutex_);
+      LockGuard<ServerPolicy::Mutex> lock(mutex_);
       functors.swap(pendingFunctors_);
     }
 
-    for (size_t i = 0; i < functors.size(); ++i) functors[i]();
+    // 至少执行一个, 超过时间额度后剩下的按原顺序放回队列头部
+    size_t i = 0;
+    if (!functors.empty()) {
+        int64_t deadline = monotonicMicros() + functorBudgetUs_;
+        do {
+            functors[i++]();
+        } while (i < functors.size() && monotonicMicros() < deadline);
+    }
+    if (i < functors.size()) {
+        LockGuard<ServerPolicy::Mutex> lock(mutex_);
+        pendingFunctors_.insert(pendingFunctors_.begin(),
+                                std::make_move_iterator(functors.begin() + i),
+                                std::make_move_iterator(functors.end()));
+        functorsDeferred_ = true;
+        metricAdd(M_FUNCTOR_DEFERRALS, 1);
+    }
     callingPendingFunctors_ = false;
 }
 
+HttpData* EventLoop::findConnection(int fd, uint64_t id) const {
+    HttpData* conn = poller_->getHolder(fd);
+    return conn != NULL && conn->id() == id ? conn : NULL;
+}
+
 void EventLoop::quit() {
     quit_ = true;
     if (!isInLoopThread()) {
@@ -1,15 +1,23 @@
 #pragma once
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <vector>
 #include "Channel.h"
 #include "Epoll.h"
+#include "FileCache.h"
+#include "MutexLock.h"
+#include "Policy.h"
+#include "RateLimiter.h"
+#include "ResponseHeader.h"
 #include "Util.h"
 #include "CurrentThread.h"
 #include "Logging.h"
 #include "Thread.h"
 #include <iostream>
 
+class FileLoader;
+
 class EventLoop {
 public:
     typedef std::function<void()> Functor;
@@ -19,34 +27,75 @@ public:
     void quit();
     void runInLoop(Functor&& cb);
     void queueInLoop(Functor&& cb);
+    // 只能在IO线程调用: 本次事件的额度已经用完但还有数据可读的连接排在这里,
+    // 下一轮不阻塞地poll, 处理完新的事件后依次继续, 连接之间轮流读取
+    void queueReady(Functor&& cb) {
+        assertInLoopThread();
+        readyQueue_.emplace_back(std::move(cb));
+    }
+    // 每轮执行queueInLoop回调的时间额度(微秒), 超过时剩下的留到下一轮
+    void setFunctorBudget(int usec) { functorBudgetUs_ = usec; }
+    // 最近各轮循环耗时的指数平均(微秒), 阻塞在poll中(空闲)时为0, 可以在其它线程读
+    int loadUs() const {
+        return polling_.load(std::memory_order_relaxed) ? 0
+                                                        : loadUs_.load(std::memory_order_relaxed);
+    }
     bool isInLoopThread() const { return threadId_ == CurrentThread::tid(); }
     void assertInLoopThread() { assert(isInLoopThread()); }
-    void shutdown(std::shared_ptr<Channel> channel) { shutDownWR(channel->getFd()); }
-    void removeFromPoller(std::shared_ptr<Channel> channel) {
+    void shutdown(Channel *channel) { shutDownWR(channel->getFd()); }
+    void removeFromPoller(Channel *channel) {
     // shutDownWR(channel->getFd());
         poller_->epoll_del(channel);
     }
-    void updatePoller(std::shared_ptr<Channel> channel, int timeout = 0) {
+    void updatePoller(Channel *channel, int timeout = 0) {
         poller_->epoll_mod(channel, timeout);
     }
-    void addToPoller(std::shared_ptr<Channel> channel, int timeout = 0) {
+    void addToPoller(Channel *channel, int timeout = 0) {
         poller_->epoll_add(channel, timeout);
     }
+    // 只能在IO线程调用: 本线程的连接编号, 和描述符一起区分先后使用同一个描述符的连接
+    uint64_t nextConnectionId() { return ++connectionIds_; }
+    // 描述符对应的连接仍然注册在poller中, 并且编号相同时返回它, 否则返回NULL
+    HttpData *findConnection(int fd, uint64_t id) const;
+    FileCache &fileCache() { return fileCache_; }
+    // 所有IO线程共用, 由Server::start设置; NULL时文件操作在本线程中直接进行
+    FileLoader *fileLoader() const { return fileLoader_; }
+    void setFileLoader(FileLoader *loader) { fileLoader_ = loader; }
+    // 用于本线程连接上的请求, 由Server::start配置
+    RateLimiter &rateLimiter() { return rateLimiter_; }
+    // 本轮poll返回时的时间(秒), 同一轮内的事件共用
+    time_t now() const { return now_; }
+    std::string_view dateLine() { return headerCache_.dateLine(now_); }
 
 private:
+    friend class Channel;
+
     bool looping_;
-    std::shared_ptr<Epoll> poller_;
+    std::shared_ptr<ServerPolicy::Poller> poller_;
     int wakeupFd_;
     bool quit_;
     bool eventHandling_;
-    mutable MutexLock mutex_;
+    mutable ServerPolicy::Mutex mutex_;
     std::vector<Functor> pendingFunctors_;
     bool callingPendingFunctors_;
+    // 上一轮没有执行完的回调, 下一轮的poll不能阻塞
+    bool functorsDeferred_;
+    int functorBudgetUs_;
+    std::vector<Functor> readyQueue_;
+    std::atomic<bool> polling_;
+    std::atomic<int> loadUs_;
     const pid_t threadId_;
-    std::shared_ptr<Channel> pwakeupChannel_;
+    std::unique_ptr<Channel> pwakeupChannel_;
+    uint64_t connectionIds_;
+    FileCache fileCache_;
+    FileLoader *fileLoader_;
+    RateLimiter rateLimiter_;
+    HeaderCache headerCache_;
+    time_t now_;
 
     void wakeup();
     void handleRead();
     void doPendingFunctors();
+    void doReadyQueue();
     void handleConn();
 };
\ No newline at end of file
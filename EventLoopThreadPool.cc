@@ -2,7 +2,9 @@
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop *baseLoop, int numThreads)
     : baseLoop_(baseLoop), started_(false), numThreads_(numThreads), next_(0) {
-    if (numThreads_ <= 0) {
+    // 单线程配置中没有IO线程, 连接都由baseLoop处理
+    if (!ServerPolicy::kMultiThread) numThreads_ = 0;
+    if (numThreads_ <= 0 && ServerPolicy::kMultiThread) {
         LOG << "numThreads_ <= 0";
         abort();
     }
@@ -16,15 +18,13 @@ void EventLoopThreadPool::start() {
         threads_.push_back(t);
         loops_.push_back(t->startLoop());
     }
+    if (loops_.empty()) loops_.push_back(baseLoop_);
 }
 
 EventLoop *EventLoopThreadPool::getNextLoop() {
     baseLoop_->assertInLoopThread();
     assert(started_);
-    EventLoop *loop = baseLoop_;
-    if (!loops_.empty()) {
-        loop = loops_[next_];
-        next_ = (next_ + 1) % numThreads_;
-    }
+    EventLoop *loop = loops_[next_];
+    next_ = (next_ + 1) % loops_.size();
     return loop;
 }
\ No newline at end of file
@@ -14,6 +14,8 @@ public:
     void start();
 
     EventLoop* getNextLoop();
+    // 处理连接的EventLoop: 线程池中的IO线程, 没有IO线程时只有baseLoop
+    const std::vector<EventLoop*>& getAllLoops() const { return loops_; }
 
 private:
     EventLoop* baseLoop_;
@@ -0,0 +1,69 @@
+#include "FileCache.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static size_t nowMs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000));
+}
+
+void FileCache::formatHttpDate(time_t t, std::string &out) {
+    struct tm tm_time;
+    gmtime_r(&t, &tm_time);
+    char buf[32];
+    size_t len = strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm_time);
+    out.assign(buf, len);
+}
+
+const FileInfo &FileCache::lookup(const std::string &path) {
+    size_t now = nowMs();
+    auto it = cache_.find(path);
+    // 时间戳按10000秒回绕, now < checkedAt时同样视为过期
+    if (it != cache_.end() && now >= it->second.checkedAt &&
+        now - it->second.checkedAt < static_cast<size_t>(kTtlMs))
+        return it->second;
+
+    FileInfo &info = it != cache_.end() ? it->second : entry(path);
+    info.checkedAt = now;
+    struct stat sbuf;
+    update(info, stat(path.c_str(), &sbuf) < 0 ? NULL : &sbuf);
+    return info;
+}
+
+void FileCache::store(const std::string &path, const struct stat *st) {
+    size_t now = nowMs();
+    auto it = cache_.find(path);
+    FileInfo &info = it != cache_.end() ? it->second : entry(path);
+    info.checkedAt = now;
+    update(info, st);
+}
+
+// 新的表项, 超过kMaxEntries时先清空
+FileInfo &FileCache::entry(const std::string &path) {
+    if (cache_.size() >= kMaxEntries) cache_.clear();
+    return cache_[path];
+}
+
+void FileCache::update(FileInfo &info, const struct stat *st) {
+    if (st == NULL || !S_ISREG(st->st_mode)) {
+        info.regular = false;
+        info.size = 0;
+        info.mtime = 0;
+        info.etag.clear();
+        info.lastModified.clear();
+        return;
+    }
+    // 元数据未变时校验值也不变, 避免重复格式化
+    if (info.regular && info.size == st->st_size && info.mtime == st->st_mtime) return;
+    info.regular = true;
+    info.size = st->st_size;
+    info.mtime = st->st_mtime;
+    char buf[64];
+    int len = snprintf(buf, sizeof buf, "\"%lx-%lx\"",
+                       static_cast<unsigned long>(info.mtime),
+                       static_cast<unsigned long>(info.size));
+    info.etag.assign(buf, len);
+    formatHttpDate(info.mtime, info.lastModified);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+#include "noncopyable.h"
+
+struct FileInfo {
+    bool regular;              // 存在且为普通文件
+    off_t size;
+    time_t mtime;
+    std::string etag;          // "mtime-size" 形式的强校验值
+    std::string lastModified;  // RFC 1123 格式
+    size_t checkedAt;          // 上次stat的时间(ms)
+};
+
+// 每个EventLoop一份, 只在所属线程使用, 不需要加锁
+// 在kTtlMs内重复访问同一文件直接使用缓存的元数据和校验值, 不再stat
+class FileCache : noncopyable {
+public:
+    static const int kTtlMs = 1000;
+    static const size_t kMaxEntries = 4096;
+
+    FileCache() {}
+    // 不存在或不是普通文件时返回的FileInfo::regular为false
+    const FileInfo &lookup(const std::string &path);
+    // 缓存过(不论是否过期)的文件, 用于判断是否为第一次访问
+    bool contains(const std::string &path) const { return cache_.count(path) != 0; }
+    // 记录在其它线程中stat的结果, st为NULL表示不存在; 之后kTtlMs内lookup直接使用
+    void store(const std::string &path, const struct stat *st);
+
+    static void formatHttpDate(time_t t, std::string &out);
+
+private:
+    FileInfo &entry(const std::string &path);
+    static void update(FileInfo &info, const struct stat *st);
+
+    std::unordered_map<std::string, FileInfo> cache_;
+};
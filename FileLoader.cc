@@ -0,0 +1,119 @@
+#include "FileLoader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include "EventLoop.h"
+#include "Metrics.h"
+
+using namespace std;
+
+FileLoader::FileLoader(int numThreads, size_t prefetchBytes)
+    : numThreads_(numThreads),
+      prefetchBytes_(prefetchBytes),
+      running_(false),
+      mutex_(),
+      cond_(mutex_) {}
+
+FileLoader::~FileLoader() {
+    {
+        MutexLockGuard lock(mutex_);
+        running_ = false;
+    }
+    cond_.notifyAll();
+    for (auto &t : threads_) t->join();
+}
+
+void FileLoader::start() {
+    running_ = true;
+    for (int i = 0; i < numThreads_; ++i) {
+        threads_.emplace_back(new Thread(bind(&FileLoader::threadFunc, this), "FileLoader"));
+        threads_.back()->start();
+    }
+}
+
+void FileLoader::load(EventLoop *loop, const string &path, Callback cb) {
+    Waiter waiter = {loop, std::move(cb)};
+    {
+        MutexLockGuard lock(mutex_);
+        vector<Waiter> &waiters = inflight_[path];
+        bool first = waiters.empty();
+        waiters.push_back(std::move(waiter));
+        if (first) {
+            queue_.push_back(path);
+            cond_.notify();
+            return;
+        }
+    }
+    metricAdd(M_FILE_LOADS_COALESCED, 1);
+}
+
+void FileLoader::run(function<void()> task) {
+    {
+        MutexLockGuard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    cond_.notify();
+}
+
+void FileLoader::threadFunc() {
+    while (true) {
+        string path;
+        function<void()> task;
+        {
+            MutexLockGuard lock(mutex_);
+            while (running_ && queue_.empty() && tasks_.empty()) cond_.wait();
+            if (!running_) return;
+            if (!tasks_.empty()) {
+                task.swap(tasks_.front());
+                tasks_.pop_front();
+            } else {
+                path.swap(queue_.front());
+                queue_.pop_front();
+            }
+        }
+        if (task) {
+            task();
+            continue;
+        }
+        Result result = doLoad(path);
+        metricAdd(M_FILE_LOADS, 1);
+        vector<Waiter> waiters;
+        {
+            MutexLockGuard lock(mutex_);
+            auto it = inflight_.find(path);
+            waiters.swap(it->second);
+            inflight_.erase(it);
+        }
+        for (Waiter &w : waiters) {
+            Callback cb(std::move(w.cb));
+            w.loop->queueInLoop([cb, path, result] { cb(path, result); });
+        }
+    }
+}
+
+FileLoader::Result FileLoader::doLoad(const string &path) {
+    Result result;
+    result.err = 0;
+    if (stat(path.c_str(), &result.st) < 0) {
+        result.err = errno;
+        return result;
+    }
+    if (!S_ISREG(result.st.st_mode) || prefetchBytes_ == 0 || result.st.st_size == 0)
+        return result;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        result.err = errno;
+        return result;
+    }
+    // 读一遍文件的开头, 之后IO线程中映射的窗口缺页时数据已经在页缓存中
+    static __thread char buf[64 * 1024];
+    off_t want = min(static_cast<off_t>(prefetchBytes_), result.st.st_size);
+    for (off_t offset = 0; offset < want;) {
+        ssize_t n = pread(fd, buf, min(static_cast<off_t>(sizeof buf), want - offset), offset);
+        if (n <= 0) break;
+        offset += n;
+    }
+    close(fd);
+    return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <sys/stat.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Condition.h"
+#include "MutexLock.h"
+#include "Thread.h"
+#include "noncopyable.h"
+
+class EventLoop;
+
+// 在后台线程中执行可能等待磁盘的文件操作: 冷文件的stat, open, 把文件开头读入页缓存,
+// 以及run提交的其它操作(上传完成时的落盘),
+// 结果用queueInLoop投递回发起请求的EventLoop, IO线程不会因为一次慢的磁盘读取卡住所有连接.
+// 同一路径的操作还没有完成时, 后来的请求(可以来自不同的IO线程)不再排队, 共享同一次的结果
+class FileLoader : noncopyable {
+public:
+    struct Result {
+        int err;         // 0或stat/open失败的errno
+        struct stat st;  // err为0时有效
+    };
+    // 在发起请求的EventLoop中执行
+    typedef std::function<void(const std::string &path, const Result &result)> Callback;
+
+    // prefetchBytes为预读的文件开头的字节数, 0表示只stat
+    FileLoader(int numThreads, size_t prefetchBytes);
+    ~FileLoader();
+    void start();
+    // 可以在任意IO线程中调用
+    void load(EventLoop *loop, const std::string &path, Callback cb);
+    // 在后台线程中执行其它可能等待磁盘的操作(如上传完成时的fdatasync), 不合并,
+    // 结果由task自己用queueInLoop投递回IO线程; 可以在任意线程中调用
+    void run(std::function<void()> task);
+
+private:
+    struct Waiter {
+        EventLoop *loop;
+        Callback cb;
+    };
+
+    void threadFunc();
+    Result doLoad(const std::string &path);
+
+    const int numThreads_;
+    const size_t prefetchBytes_;
+    bool running_;
+    MutexLock mutex_;
+    Condition cond_;
+    std::deque<std::string> queue_;
+    std::deque<std::function<void()>> tasks_;
+    // 正在进行(排队或执行中)的路径和等待它的请求
+    std::unordered_map<std::string, std::vector<Waiter>> inflight_;
+    std::vector<std::unique_ptr<Thread>> threads_;
+};
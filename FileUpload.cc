@@ -0,0 +1,228 @@
+#include "FileUpload.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventLoop.h"
+#include "FileLoader.h"
+#include "Logging.h"
+
+using namespace std;
+
+namespace {
+
+// FSYNC_ON_COMPLETE时每写这么多就启动一次回写, 最后fdatasync需要等待的脏页不超过它
+const uint64_t kWritebackInterval = 8 * 1024 * 1024;
+
+// 每个IO线程一个pipe, 每次splice进去的数据都立即全部移到文件, 两次使用之间总是空的
+__thread int t_pipe[2] = {-1, -1};
+
+void resetThreadPipe() {
+    close(t_pipe[0]);
+    close(t_pipe[1]);
+    t_pipe[0] = t_pipe[1] = -1;
+}
+
+// 临时文件落盘后rename为目标文件, 失败时删除临时文件; fd总是被关闭
+bool finishUpload(int fd, const string &tmpPath, const string &path,
+                  const UploadOptions &options) {
+    bool ok = options.fsync != FSYNC_ON_COMPLETE || fdatasync(fd) == 0;
+    close(fd);
+    if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        LOG << "Upload " << path << " cannot be saved: " << strerror(errno);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    // rename本身也要落盘
+    if (options.fsync == FSYNC_ON_COMPLETE) {
+        int dirfd = ::open(options.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd >= 0) {
+            fsync(dirfd);
+            close(dirfd);
+        }
+    }
+    return true;
+}
+
+// 只允许目录下的普通文件名, 不能以'.'开头(临时文件以'.'开头)
+bool validName(string_view name) {
+    return !name.empty() && name.size() < NAME_MAX - 8 && name[0] != '.' &&
+        name.find('/') == string_view::npos && name.find('\0') == string_view::npos;
+}
+
+class FileUploadSink : public BodySink {
+public:
+    FileUploadSink(const shared_ptr<const UploadOptions> &options, string_view name)
+        : options_(options),
+          path_(options->dir + "/" + string(name)),
+          fd_(-1),
+          offset_(0),
+          writebackFrom_(0),
+          status_(0) {}
+    ~FileUploadSink() { discard(); }
+
+    // 在目标目录下创建临时文件
+    bool open();
+
+    size_t onData(string_view data) override;
+    void onEnd(HttpResponse &resp) override;
+    void onAbort() override {
+        LOG << "Upload " << path_ << " aborted after " << static_cast<long>(offset_) << " bytes";
+    }
+    bool canReadFrom() const override { return true; }
+    ssize_t readFrom(int fd, size_t maxBytes) override;
+
+private:
+    void startWriteback();
+    void fail(int status) {
+        status_ = status;
+        discard();
+    }
+    void discard() {
+        if (fd_ < 0) return;
+        close(fd_);
+        unlink(tmpPath_.c_str());
+        fd_ = -1;
+    }
+
+    shared_ptr<const UploadOptions> options_;
+    string path_;
+    string tmpPath_;
+    int fd_;
+    loff_t offset_;
+    loff_t writebackFrom_;
+    // 写文件出错后的响应状态码, 剩下的body照常收完再回复
+    int status_;
+};
+
+bool FileUploadSink::open() {
+    size_t slash = path_.rfind('/');
+    tmpPath_ = path_.substr(0, slash + 1) + "." + path_.substr(slash + 1) + ".XXXXXX";
+    fd_ = mkostemp(&tmpPath_[0], O_CLOEXEC);
+    if (fd_ < 0) return false;
+    fchmod(fd_, 0644);
+    return true;
+}
+
+// chunked的body和随头部一起读进来的部分
+size_t FileUploadSink::onData(string_view data) {
+    if (status_ != 0) return data.size();
+    if (static_cast<uint64_t>(offset_) + data.size() > options_->maxBytes) {
+        discard();
+        reject(413, "Payload Too Large");
+        return data.size();
+    }
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = pwrite(fd_, p, left, offset_);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            LOG << "Upload " << path_ << " write failed: " << strerror(errno);
+            fail(500);
+            return data.size();
+        }
+        p += n;
+        left -= n;
+        offset_ += n;
+    }
+    startWriteback();
+    return data.size();
+}
+
+// socket -> pipe -> 文件, 数据不经过用户空间
+ssize_t FileUploadSink::readFrom(int fd, size_t maxBytes) {
+    if (status_ != 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (t_pipe[0] < 0 && pipe2(t_pipe, O_NONBLOCK | O_CLOEXEC) < 0) return -1;
+    ssize_t n = splice(fd, NULL, t_pipe[1], NULL, maxBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0) return n;
+    size_t left = n;
+    while (left > 0) {
+        ssize_t m = splice(t_pipe[0], NULL, fd_, &offset_, left, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) {
+            int saved = m < 0 ? errno : EIO;
+            LOG << "Upload " << path_ << " splice failed: " << strerror(saved);
+            // pipe中剩下的数据取不回来了, 换一个新的
+            resetThreadPipe();
+            fail(500);
+            errno = saved;
+            return -1;
+        }
+        left -= m;
+    }
+    startWriteback();
+    return n;
+}
+
+// 只启动回写不等待, 不阻塞IO线程
+void FileUploadSink::startWriteback() {
+    if (options_->fsync != FSYNC_ON_COMPLETE ||
+        static_cast<uint64_t>(offset_ - writebackFrom_) < kWritebackInterval)
+        return;
+    sync_file_range(fd_, writebackFrom_, offset_ - writebackFrom_, SYNC_FILE_RANGE_WRITE);
+    writebackFrom_ = offset_;
+}
+
+// 落盘可能要等待很久, 交给FileLoader的线程, 完成后回到IO线程发送响应
+void FileUploadSink::onEnd(HttpResponse &resp) {
+    if (status_ != 0) {
+        resp.sendError(500, "Internal Server Error");
+        return;
+    }
+    shared_ptr<ResponseWriter> writer = resp.defer();
+    int fd = fd_;
+    fd_ = -1;
+    string created = to_string(offset_) + " bytes\n";
+    EventLoop *loop = writer->loop();
+    FileLoader *loader = loop->fileLoader();
+    if (loader == NULL) {
+        if (finishUpload(fd, tmpPath_, path_, *options_))
+            writer->send(201, "Created", "text/plain", created);
+        else
+            writer->sendError(500, "Internal Server Error");
+        return;
+    }
+    shared_ptr<const UploadOptions> options(options_);
+    string tmpPath(tmpPath_), path(path_);
+    loader->run([writer, loop, fd, tmpPath, path, options, created] {
+        bool ok = finishUpload(fd, tmpPath, path, *options);
+        loop->queueInLoop([writer, ok, created] {
+            if (ok)
+                writer->send(201, "Created", "text/plain", created);
+            else
+                writer->sendError(500, "Internal Server Error");
+        });
+    });
+}
+
+}  // namespace
+
+StreamHandler makeUploadHandler(const UploadOptions &options) {
+    shared_ptr<const UploadOptions> opts(new UploadOptions(options));
+    return [opts](const HttpRequest &req, HttpResponse &resp) -> shared_ptr<BodySink> {
+        string_view name = req.param("*");
+        if (!validName(name)) {
+            resp.sendError(400, "Bad Request");
+            return NULL;
+        }
+        // 定长的body在发送100 Continue之前就按配额拒绝
+        string_view length = req.header(HDR_CONTENT_LENGTH);
+        if (!length.empty() && strtoull(string(length).c_str(), NULL, 10) > opts->maxBytes) {
+            resp.sendError(413, "Payload Too Large");
+            return NULL;
+        }
+        shared_ptr<FileUploadSink> sink(new FileUploadSink(opts, name));
+        if (!sink->open()) {
+            LOG << "Upload " << opts->dir << ": cannot create file: " << strerror(errno);
+            resp.sendError(500, "Internal Server Error");
+            return NULL;
+        }
+        return sink;
+    };
+}
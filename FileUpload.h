@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "HttpHandler.h"
+#include "Router.h"
+
+enum FsyncPolicy {
+    FSYNC_NONE = 0,     // 交给内核回写
+    FSYNC_ON_COMPLETE,  // 回复201之前fdatasync文件并fsync目录(在FileLoader的线程中)
+};
+
+struct UploadOptions {
+    std::string dir = ".";  // 保存上传文件的目录, 需要已经存在
+    // 每个连接一次上传的上限, 定长body在头部解析完就拒绝(413), chunked在超过时立即拒绝并关闭连接
+    uint64_t maxBytes = 1024ull * 1024 * 1024;
+    FsyncPolicy fsync = FSYNC_ON_COMPLETE;
+};
+
+// 上传到磁盘的流式路由, 路由的通配部分(不含'/')作为文件名, 如POST "/upload/*"
+// 定长body用splice经每个线程一个的pipe从socket移到文件, 不拷贝到用户空间;
+// chunked的body解码后write. 先写临时文件, 完成后rename, 中途断开时删除;
+// 收完后的fdatasync, rename和目录的fsync交给FileLoader的线程(没有时在IO线程中)
+StreamHandler makeUploadHandler(const UploadOptions &options);
@@ -1,623 +1,1154 @@
 #include "HttpData.h"
+#include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <climits>
+#include <strings.h>
 #include <iostream>
+#include <new>
+#include "Assets.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "FileCache.h"
+#include "FileLoader.h"
+#include "HttpHandler.h"
+#include "HttpOptions.h"
+#include "MappedFile.h"
+#include "Metrics.h"
+#include "MimeType.h"
+#include "OutputQueue.h"
+#include "ResponseHeader.h"
 #include "Util.h"
 #include "time.h"
 
 using namespace std;
 
-pthread_once_t MimeType::once_control = PTHREAD_ONCE_INIT;
-std::unordered_map<std::string, std::string> MimeType::mime;
-
 const __uint32_t DEFAULT_EVENT = EPOLLIN | EPOLLET | EPOLLONESHOT;
-const int DEFAULT_EXPIRED_TIME = 2000;              // ms
-const int DEFAULT_KEEP_ALIVE_TIME = 5 * 60 * 1000;  // ms
-
-char favicon[555] = {
-    '\x89', 'P',    'N',    'G',    '\xD',  '\xA',  '\x1A', '\xA',  '\x0',
-    '\x0',  '\x0',  '\xD',  'I',    'H',    'D',    'R',    '\x0',  '\x0',
-    '\x0',  '\x10', '\x0',  '\x0',  '\x0',  '\x10', '\x8',  '\x6',  '\x0',
-    '\x0',  '\x0',  '\x1F', '\xF3', '\xFF', 'a',    '\x0',  '\x0',  '\x0',
-    '\x19', 't',    'E',    'X',    't',    'S',    'o',    'f',    't',
-    'w',    'a',    'r',    'e',    '\x0',  'A',    'd',    'o',    'b',
-    'e',    '\x20', 'I',    'm',    'a',    'g',    'e',    'R',    'e',
-    'a',    'd',    'y',    'q',    '\xC9', 'e',    '\x3C', '\x0',  '\x0',
-    '\x1',  '\xCD', 'I',    'D',    'A',    'T',    'x',    '\xDA', '\x94',
-    '\x93', '9',    'H',    '\x3',  'A',    '\x14', '\x86', '\xFF', '\x5D',
-    'b',    '\xA7', '\x4',  'R',    '\xC4', 'm',    '\x22', '\x1E', '\xA0',
-    'F',    '\x24', '\x8',  '\x16', '\x16', 'v',    '\xA',  '6',    '\xBA',
-    'J',    '\x9A', '\x80', '\x8',  'A',    '\xB4', 'q',    '\x85', 'X',
-    '\x89', 'G',    '\xB0', 'I',    '\xA9', 'Q',    '\x24', '\xCD', '\xA6',
-    '\x8',  '\xA4', 'H',    'c',    '\x91', 'B',    '\xB',  '\xAF', 'V',
-    '\xC1', 'F',    '\xB4', '\x15', '\xCF', '\x22', 'X',    '\x98', '\xB',
-    'T',    'H',    '\x8A', 'd',    '\x93', '\x8D', '\xFB', 'F',    'g',
-    '\xC9', '\x1A', '\x14', '\x7D', '\xF0', 'f',    'v',    'f',    '\xDF',
-    '\x7C', '\xEF', '\xE7', 'g',    'F',    '\xA8', '\xD5', 'j',    'H',
-    '\x24', '\x12', '\x2A', '\x0',  '\x5',  '\xBF', 'G',    '\xD4', '\xEF',
-    '\xF7', '\x2F', '6',    '\xEC', '\x12', '\x20', '\x1E', '\x8F', '\xD7',
-    '\xAA', '\xD5', '\xEA', '\xAF', 'I',    '5',    'F',    '\xAA', 'T',
-    '\x5F', '\x9F', '\x22', 'A',    '\x2A', '\x95', '\xA',  '\x83', '\xE5',
-    'r',    '9',    'd',    '\xB3', 'Y',    '\x96', '\x99', 'L',    '\x6',
-    '\xE9', 't',    '\x9A', '\x25', '\x85', '\x2C', '\xCB', 'T',    '\xA7',
-    '\xC4', 'b',    '1',    '\xB5', '\x5E', '\x0',  '\x3',  'h',    '\x9A',
-    '\xC6', '\x16', '\x82', '\x20', 'X',    'R',    '\x14', 'E',    '6',
-    'S',    '\x94', '\xCB', 'e',    'x',    '\xBD', '\x5E', '\xAA', 'U',
-    'T',    '\x23', 'L',    '\xC0', '\xE0', '\xE2', '\xC1', '\x8F', '\x0',
-    '\x9E', '\xBC', '\x9',  'A',    '\x7C', '\x3E', '\x1F', '\x83', 'D',
-    '\x22', '\x11', '\xD5', 'T',    '\x40', '\x3F', '8',    '\x80', 'w',
-    '\xE5', '3',    '\x7',  '\xB8', '\x5C', '\x2E', 'H',    '\x92', '\x4',
-    '\x87', '\xC3', '\x81', '\x40', '\x20', '\x40', 'g',    '\x98', '\xE9',
-    '6',    '\x1A', '\xA6', 'g',    '\x15', '\x4',  '\xE3', '\xD7', '\xC8',
-    '\xBD', '\x15', '\xE1', 'i',    '\xB7', 'C',    '\xAB', '\xEA', 'x',
-    '\x2F', 'j',    'X',    '\x92', '\xBB', '\x18', '\x20', '\x9F', '\xCF',
-    '3',    '\xC3', '\xB8', '\xE9', 'N',    '\xA7', '\xD3', 'l',    'J',
-    '\x0',  'i',    '6',    '\x7C', '\x8E', '\xE1', '\xFE', 'V',    '\x84',
-    '\xE7', '\x3C', '\x9F', 'r',    '\x2B', '\x3A', 'B',    '\x7B', '7',
-    'f',    'w',    '\xAE', '\x8E', '\xE',  '\xF3', '\xBD', 'R',    '\xA9',
-    'd',    '\x2',  'B',    '\xAF', '\x85', '2',    'f',    'F',    '\xBA',
-    '\xC',  '\xD9', '\x9F', '\x1D', '\x9A', 'l',    '\x22', '\xE6', '\xC7',
-    '\x3A', '\x2C', '\x80', '\xEF', '\xC1', '\x15', '\x90', '\x7',  '\x93',
-    '\xA2', '\x28', '\xA0', 'S',    'j',    '\xB1', '\xB8', '\xDF', '\x29',
-    '5',    'C',    '\xE',  '\x3F', 'X',    '\xFC', '\x98', '\xDA', 'y',
-    'j',    'P',    '\x40', '\x0',  '\x87', '\xAE', '\x1B', '\x17', 'B',
-    '\xB4', '\x3A', '\x3F', '\xBE', 'y',    '\xC7', '\xA',  '\x26', '\xB6',
-    '\xEE', '\xD9', '\x9A', '\x60', '\x14', '\x93', '\xDB', '\x8F', '\xD',
-    '\xA',  '\x2E', '\xE9', '\x23', '\x95', '\x29', 'X',    '\x0',  '\x27',
-    '\xEB', 'n',    'V',    'p',    '\xBC', '\xD6', '\xCB', '\xD6', 'G',
-    '\xAB', '\x3D', 'l',    '\x7D', '\xB8', '\xD2', '\xDD', '\xA0', '\x60',
-    '\x83', '\xBA', '\xEF', '\x5F', '\xA4', '\xEA', '\xCC', '\x2',  'N',
-    '\xAE', '\x5E', 'p',    '\x1A', '\xEC', '\xB3', '\x40', '9',    '\xAC',
-    '\xFE', '\xF2', '\x91', '\x89', 'g',    '\x91', '\x85', '\x21', '\xA8',
-    '\x87', '\xB7', 'X',    '\x7E', '\x7E', '\x85', '\xBB', '\xCD', 'N',
-    'N',    'b',    't',    '\x40', '\xFA', '\x93', '\x89', '\xEC', '\x1E',
-    '\xEC', '\x86', '\x2',  'H',    '\x26', '\x93', '\xD0', 'u',    '\x1D',
-    '\x7F', '\x9',  '2',    '\x95', '\xBF', '\x1F', '\xDB', '\xD7', 'c',
-    '\x8A', '\x1A', '\xF7', '\x5C', '\xC1', '\xFF', '\x22', 'J',    '\xC3',
-    '\x87', '\x0',  '\x3',  '\x0',  'K',    '\xBB', '\xF8', '\xD6', '\x2A',
-    'v',    '\x98', 'I',    '\x0',  '\x0',  '\x0',  '\x0',  'I',    'E',
-    'N',    'D',    '\xAE', 'B',    '\x60', '\x82',
+const int MAX_RANGES = 16;
+// 流水线上最多排队的响应数, 超过时和待发送数据超过高水位一样暂停解析后续请求
+const int MAX_PIPELINE_DEPTH = 32;
+
+__thread unsigned t_boundarySeq = 0;
+
+std::atomic<int> HttpData::connections_(0);
+
+namespace {
+
+// 连接对象的slab: 每个IO线程一个空闲链表, 连接的创建和析构都在所属线程, 不需要加锁.
+// 一次分配一批, 每个对象从缓存行边界开始; 释放的对象留在链表中给后面的连接使用, 不归还系统
+const size_t kCacheLine = 64;
+const size_t kSlabObjects = 64;
+
+struct FreeSlot {
+    FreeSlot *next;
 };
 
-void MimeType::init() {
-    mime[".html"] = "text/html";
-    mime[".avi"] = "video/x-msvideo";
-    mime[".bmp"] = "image/bmp";
-    mime[".c"] = "text/plain";
-    mime[".doc"] = "application/msword";
-    mime[".gif"] = "image/gif";
-    mime[".gz"] = "application/x-gzip";
-    mime[".htm"] = "text/html";
-    mime[".ico"] = "image/x-icon";
-    mime[".jpg"] = "image/jpeg";
-    mime[".png"] = "image/png";
-    mime[".txt"] = "text/plain";
-    mime[".mp3"] = "audio/mp3";
-    mime["default"] = "text/html";
-}
-
-std::string MimeType::getMime(const std::string &suffix) {
-  pthread_once(&once_control, MimeType::init);
-    if (mime.find(suffix) == mime.end())
-        return mime["default"];
-    else
-        return mime[suffix];
+__thread FreeSlot *t_freeConnections = NULL;
+
+}  // namespace
+
+void *HttpData::operator new(size_t size) {
+    assert(size == sizeof(HttpData));
+    if (t_freeConnections == NULL) {
+        size_t slot = (size + kCacheLine - 1) / kCacheLine * kCacheLine;
+        char *slab = static_cast<char *>(aligned_alloc(kCacheLine, slot * kSlabObjects));
+        if (slab == NULL) throw std::bad_alloc();
+        // 倒序放入链表, 先分配的对象地址在前
+        for (size_t i = kSlabObjects; i > 0; --i) {
+            FreeSlot *free = reinterpret_cast<FreeSlot *>(slab + (i - 1) * slot);
+            free->next = t_freeConnections;
+            t_freeConnections = free;
+        }
+    }
+    FreeSlot *free = t_freeConnections;
+    t_freeConnections = free->next;
+    return free;
 }
 
-HttpData::HttpData(EventLoop *loop, int connfd)
+// 后进先出, 刚释放的对象还在缓存中
+void HttpData::operator delete(void *p) {
+    FreeSlot *free = static_cast<FreeSlot *>(p);
+    free->next = t_freeConnections;
+    t_freeConnections = free;
+}
+
+HttpData::HttpData(EventLoop *loop, int connfd, uint32_t peerAddr, const Router *router,
+                   const HttpOptions *options)
     : loop_(loop),
-      channel_(new Channel(loop, connfd)),
+      options_(options),
       fd_(connfd),
-      error_(false),
       connectionState_(H_CONNECTED),
+      state_(STATE_PARSE_REQUEST),
+      pendingResponses_(0),
+      error_(false),
+      keepAlive_(false),
+      bodyPaused_(false),
+      readDeferred_(false),
+      fileWait_(false),
+      flushQueued_(false),
+      shutdownAfterFlush_(false),
+      pipelinePaused_(false),
+      timeoutReason_(M_EVICT_REQUEST_LINE),
+      nowReadPos_(0),
+      bodyLength_(0),
+      timer_(NULL),
+      requestStart_(monotonicMicros()),
+      idleStart_(0),
+      channel_(loop, connfd),
+      reportedInput_(0),
+      reportedOutput_(0),
+      reportedMemory_(0),
+      router_(router),
+      id_(loop->nextConnectionId()),
+      peerAddr_(peerAddr),
       method_(METHOD_GET),
       HTTPVersion_(HTTP_11),
-      nowReadPos_(0),
-      state_(STATE_PARSE_URI),
-      hState_(H_START),
-      keepAlive_(false),
-      src_addr_(NULL),
-      src_size_(0),
-      src_transferred_(0) {
+      bodyStart_(0),
+      bodyPausedAt_(0) {
+    // 每次事件访问的字段不超过四个缓存行; 在前面加字段时先把不常用的移到后面.
+    // HttpData不是标准布局类型(有基类, 成员含std::string等), GCC和Clang对它的offsetof结果是确定的
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+    static_assert(offsetof(HttpData, channel_) <= 168, "hot fields before channel_ grew");
+    static_assert(offsetof(HttpData, reportedMemory_) + sizeof(size_t) <= 4 * kCacheLine,
+                  "per-event fields span more than four cache lines");
+#pragma GCC diagnostic pop
     // loop_->queueInLoop(bind(&HttpData::setHandlers, this));
-    channel_->setReadHandler(bind(&HttpData::handleRead, this));
-    channel_->setWriteHandler(bind(&HttpData::handleWrite, this));
-    channel_->setConnHandler(bind(&HttpData::handleConn, this));
+    channel_.setHolder(this);
+    connections_.fetch_add(1, memory_order_relaxed);
+    metricAdd(M_CONNECTIONS, 1);
+}
+
+HttpData::~HttpData() {
+    // body没有接收完连接就关闭了
+    if (sink_) sink_->onAbort();
+    // 通知流式响应的生产者连接已经关闭
+    if (stream_) {
+        stream_->closed_ = true;
+        stream_->notify();
+        stream_->drain_ = nullptr;
+    }
+    if (pipelinePaused_) metricAdd(M_READ_PAUSED_CONNECTIONS, -1);
+    metricAdd(M_INPUT_BUFFERED_BYTES, -static_cast<long>(reportedInput_));
+    metricAdd(M_OUTPUT_BUFFERED_BYTES, -static_cast<long>(reportedOutput_));
+    metricAdd(M_CONNECTION_MEMORY_BYTES, -static_cast<long>(reportedMemory_));
+    metricAdd(M_CONNECTIONS, -1);
+    connections_.fetch_sub(1, memory_order_relaxed);
+    close(fd_);
 }
 
 void HttpData::reset() {
     // inBuffer_.clear();
     fileName_.clear();
-    path_.clear();
-    nowReadPos_ = 0;
-    state_ = STATE_PARSE_URI;
-    hState_ = H_START;
-    headers_.clear();
+    state_ = STATE_PARSE_REQUEST;
+    request_.reset();
+    bodyLength_ = 0;
+    // 下一个请求的计时从它的第一个字节开始
+    requestStart_ = 0;
+    idleStart_ = monotonicMicros();
+    // 不保留上一个请求的body占用的内存
+    if (!body_.empty()) string().swap(body_);
     // keepAlive_ = false;
-    if (timer_.lock()) {
-        shared_ptr<TimerNode> my_timer(timer_.lock());
-        my_timer->clearReq();
-        timer_.reset();
-    }
+    seperateTimer();
 }
 
 void HttpData::seperateTimer() {
     // cout << "seperateTimer" << endl;
-    if (timer_.lock()) {
-        shared_ptr<TimerNode> my_timer(timer_.lock());
-        my_timer->clearReq();
-        timer_.reset();
+    if (timer_) {
+        // 节点的引用不能是最后一个, 调用者(正在处理的事件或回调)应当持有引用
+        assert(refCount() > 1);
+        TimerNode *timer = timer_;
+        timer_ = NULL;
+        timer->clearReq();
     }
 }
 
 void HttpData::handleRead() {
-    __uint32_t &events_ = channel_->getEvents();
-    do {
-        bool zero = false;
-        int read_num = readn(fd_, inBuffer_, zero);
-        LOG << "Request: " << inBuffer_;
-        if (connectionState_ == H_DISCONNECTING) {
-            inBuffer_.clear();
-            break;
+    __uint32_t &events_ = channel_.getEvents();
+    // 每次最多读readChunkSize字节, 处理完再读, 大的body不会整个堆在inBuffer_里
+    // ET模式下没有读到EAGAIN就不会再收到通知, 所以一直读到读空, 对端关闭或暂停为止;
+    // 读满readBudget时由就绪队列在下一轮继续
+    bool more = true;
+    size_t readBytes = 0;
+    while (more) {
+        more = false;
+        // 暂停期间不从socket读, 让内核接收缓冲区承担背压
+        if (!pipelinePaused_ && !bodyPaused_ && !stream_ && !fileWait_ &&
+            connectionState_ == H_CONNECTED) {
+            // 已经在就绪队列中, 由它继续
+            if (readDeferred_) break;
+            if (readBytes > 0 && readBytes >= options_->readBudget) {
+                deferRead();
+                break;
+            }
+            bool zero = false;
+            size_t limit = options_->readChunkSize;
+            ssize_t read_num;
+            if (directBody()) {
+                // BodySink直接从socket取走定长body, 不经过inBuffer_
+                if (bodyDecoder_.remaining() < limit) limit = bodyDecoder_.remaining();
+                read_num = sink_->readFrom(fd_, limit);
+                // 一次可能取不满limit, 一直读到EAGAIN为止
+                if (read_num > 0) {
+                    bodyDecoder_.consume(read_num);
+                    more = true;
+                } else if (read_num == 0) {
+                    zero = true;
+                } else if (errno == EAGAIN) {
+                    read_num = 0;
+                } else {
+                    perror("readFrom");
+                    error_ = true;
+                    handleError(fd_, 500, "Internal Server Error");
+                    return;
+                }
+            } else {
+                read_num = readn(fd_, inBuffer_, zero, limit);
+                LOG << "Request: " << inBuffer_;
+            }
+            if (read_num < 0) {
+                perror("1");
+                error_ = true;
+                handleError(fd_, 400, "Bad Request");
+                return;
+            }
+            // 对端关闭了写端, 处理完已经收到的请求后关闭连接
+            if (zero) connectionState_ = H_DISCONNECTING;
+            if (static_cast<size_t>(read_num) == limit) more = true;
+            readBytes += read_num;
         }
-        
-        if (read_num < 0 || zero) {
-            perror("1");
-            error_ = true;
-            handleError(fd_, 400, "Bad Request");
-            break;
+        processPipeline();
+        if (error_) return;
+        // 输出能立即发到低水位以下时不必等EPOLLOUT, 继续处理
+        if (pipelinePaused_) {
+            flushOutput();
+            if (error_) return;
+            if (pipelineDrained()) {
+                lowWaterMark();
+                more = true;
+            }
         }
-        else if (read_num == 0) {
-            // 有请求出现但是读不到数据，可能是Request
-            // Aborted，或者来自网络的数据没有达到等原因
-            // 最可能是对端已经关闭了，统一按照对端已经关闭处理
-            connectionState_ = H_DISCONNECTING;
-            break;
+    }
+    if (!pipelinePaused_ && !bodyPaused_ && !stream_ && !readDeferred_ && !fileWait_ &&
+        connectionState_ == H_CONNECTED)
+        events_ |= EPOLLIN;
+    // 本次读到的所有请求的响应合并成一次发送
+    if (!outBuffer_.empty()) flushOutput();
+}
+
+// 依次处理inBuffer_中的请求, 响应按顺序追加到outBuffer_
+// 待发送的响应过多或超过高水位(如有大文件正在发送)时暂停解析, 降到低水位以下后由handleWrite恢复
+void HttpData::processPipeline() {
+    while (!error_ && !pipelinePaused_ && !bodyPaused_ && !stream_ && !fileWait_ &&
+           nowReadPos_ < inBuffer_.size()) {
+        if (pipelineFull()) {
+            flushOutput();
+            if (error_) return;
+            if (pipelineFull()) {
+                highWaterMark();
+                break;
+            }
         }
+        if (!handleRequest()) break;
+        ++pendingResponses_;
+        this->reset();
+    }
+    // 一次性删除已经处理完的请求, 解析器中的偏移相对当前请求, 不受影响
+    if (nowReadPos_ > 0) {
+        inBuffer_.erase(0, nowReadPos_);
+        nowReadPos_ = 0;
+    }
+    // 缓冲区已经处理完, 但输出仍然过多时同样停止读取
+    if (!error_ && !pipelinePaused_ && pipelineFull()) highWaterMark();
+}
+
+bool HttpData::pipelineFull() const {
+    return outBuffer_.bytes() >= options_->outputHighWaterMark ||
+        pendingResponses_ >= MAX_PIPELINE_DEPTH;
+}
+
+// 暂停后要降到低水位以下才恢复, 避免在高水位附近反复暂停和恢复
+bool HttpData::pipelineDrained() const {
+    return outBuffer_.bytes() < options_->outputLowWaterMark &&
+        pendingResponses_ < MAX_PIPELINE_DEPTH;
+}
+
+// 慢客户端不读响应时不再解析和读取它的请求, EPOLLIN不再关注,
+// 未读的请求留在内核缓冲区, 由TCP流控限制客户端继续发送
+void HttpData::highWaterMark() {
+    pipelinePaused_ = true;
+    metricAdd(M_READ_PAUSED_CONNECTIONS, 1);
+    metricAdd(M_READ_PAUSES, 1);
+}
+
+void HttpData::lowWaterMark() {
+    pipelinePaused_ = false;
+    metricAdd(M_READ_PAUSED_CONNECTIONS, -1);
+}
+
+// 每次事件处理结束时把缓冲区大小的变化计入Metrics
+void HttpData::updateMetrics() {
+    size_t input = inBuffer_.size();
+    size_t output = outBuffer_.bytes();
+    if (input != reportedInput_) {
+        metricAdd(M_INPUT_BUFFERED_BYTES,
+                  static_cast<long>(input) - static_cast<long>(reportedInput_));
+        reportedInput_ = input;
+    }
+    if (output != reportedOutput_) {
+        metricAdd(M_OUTPUT_BUFFERED_BYTES,
+                  static_cast<long>(output) - static_cast<long>(reportedOutput_));
+        reportedOutput_ = output;
+    }
+    size_t memory = memoryUsage();
+    if (memory != reportedMemory_) {
+        metricAdd(M_CONNECTION_MEMORY_BYTES,
+                  static_cast<long>(memory) - static_cast<long>(reportedMemory_));
+        reportedMemory_ = memory;
+    }
+}
+
+// 长连接在两个请求之间: 没有未处理的数据, 没有待发送的响应, 等待下一个请求(对应nextTimeout的最后一种情况)
+bool HttpData::idle() const {
+    return !error_ && connectionState_ == H_CONNECTED && state_ == STATE_PARSE_REQUEST &&
+        requestStart_ == 0 && inBuffer_.empty() && outBuffer_.empty() && !stream_ &&
+        !bodyPaused_ && !pipelinePaused_ && !readDeferred_ && !fileWait_;
+}
+
+// 进入空闲时释放各缓冲区的容量, 空闲连接只保留对象本身; 下一个请求到达时再按需分配
+void HttpData::compact() {
+    if (stringHeapBytes(inBuffer_) == 0 && stringHeapBytes(fileName_) == 0 &&
+        outBuffer_.memoryUsage() == 0 && request_.memoryUsage() == 0)
+        return;
+    string().swap(inBuffer_);
+    string().swap(fileName_);
+    outBuffer_.shrink();
+    request_.shrink();
+    metricAdd(M_IDLE_COMPACTIONS, 1);
+}
+
+// 连接占用的内存: HttpData对象(含Channel)本身加上各缓冲区的堆内存, 不含分配器和控制块的开销
+size_t HttpData::memoryUsage() const {
+    return sizeof(HttpData) + stringHeapBytes(inBuffer_) +
+        stringHeapBytes(fileName_) + stringHeapBytes(body_) + outBuffer_.memoryUsage() +
+        request_.memoryUsage();
+}
 
-        if (state_ == STATE_PARSE_URI) {
-            URIState flag = this->parseURI();
-        if (flag == PARSE_URI_AGAIN)
-            break;
-        else if (flag == PARSE_URI_ERROR) {
-            perror("2");
+// 解析并处理inBuffer_中的一个请求, 完成时返回true, 数据不完整, 暂停接收body或出错返回false
+bool HttpData::handleRequest() {
+    if (state_ == STATE_PARSE_REQUEST) {
+        HttpRequestParser::Result flag =
+            request_.parse(inBuffer_.data() + nowReadPos_, inBuffer_.size() - nowReadPos_);
+        if (flag == HttpRequestParser::PARSE_AGAIN) {
+            if (inBuffer_.size() - nowReadPos_ > options_->maxHeaderSize)
+                headerTooLarge(!request_.requestLineDone());
+            return false;
+        } else if (flag == HttpRequestParser::PARSE_ERROR) {
             LOG << "FD = " << fd_ << "," << inBuffer_ << "******";
             inBuffer_.clear();
+            nowReadPos_ = 0;
             error_ = true;
             handleError(fd_, 400, "Bad Request");
-            break;
-        } else
-            state_ = STATE_PARSE_HEADERS;
+            return false;
+        }
+        // 一次就读全的头部同样受限
+        if (request_.headerLength() > options_->maxHeaderSize) {
+            headerTooLarge(request_.target().size() > options_->maxHeaderSize);
+            return false;
         }
-        if (state_ == STATE_PARSE_HEADERS) {
-            HeaderState flag = this->parseHeaders();
-        if (flag == PARSE_HEADER_AGAIN)
-            break;
-        else if (flag == PARSE_HEADER_ERROR) {
-            perror("3");
+        // 在路由和接收body之前限流, 被拒绝的请求不再消耗更多资源
+        RateLimiter &limiter = loop_->rateLimiter();
+        if (limiter.enabled() && !limiter.allow(peerAddr_, monotonicMicros())) {
+            metricAdd(M_RATE_LIMITED_REQUESTS, 1);
+            error_ = true;
+            outBuffer_.appendStatic(kTooManyRequestsResponse.data(), kTooManyRequestsResponse.size());
+            outBuffer_.flush(fd_);
+            outBuffer_.clear();
+            return false;
+        }
+        method_ = request_.method();
+        HTTPVersion_ = request_.version();
+        std::string_view connection = request_.header(HDR_CONNECTION);
+        if (connection.size() == 10 && strncasecmp(connection.data(), "keep-alive", 10) == 0)
+            keepAlive_ = true;
+        if (!beginRequest()) {
             error_ = true;
+            return false;
+        }
+    }
+    if (state_ == STATE_RECV_BODY) {
+        if (!receiveBody()) return false;
+        // 接收body期间inBuffer_可能扩容或移动过, 重新定位解析结果和路由参数
+        const char *begin = inBuffer_.data() + nowReadPos_;
+        request_.parse(begin, request_.headerLength());
+        if (!sink_)
+            router_->match(method_, string_view(request_.target().data(),
+                                                request_.path().size() + 1), match_);
+        state_ = STATE_ANALYSIS;
+    }
+    if (state_ == STATE_ANALYSIS) {
+        AnalysisState flag = sink_ ? finishStream() : analysisRequest();
+        if (flag == ANALYSIS_SUCCESS && fileWait_) {
+            // 请求留在inBuffer_中, 加载完成后由fileLoaded继续, 再发送文件
+            state_ = STATE_WAIT_FILE;
+            return false;
+        }
+        return finishRequest(flag);
+    }
+    if (state_ == STATE_WAIT_FILE && !fileWait_) {
+        // 等待期间processPipeline删除了前面已经处理完的请求, 请求在inBuffer_中的位置变了,
+        // 重新定位Range和条件请求等头部
+        request_.parse(inBuffer_.data() + nowReadPos_, request_.headerLength());
+        return finishRequest(serveCachedFile());
+    }
+    return false;
+}
+
+// 响应已经写入输出队列时跳过这个请求, 否则出错
+bool HttpData::finishRequest(AnalysisState flag) {
+    if (flag == ANALYSIS_SUCCESS) {
+        nowReadPos_ += request_.headerLength() + bodyLength_;
+        state_ = STATE_FINISH;
+        return true;
+    }
+    error_ = true;
+    return false;
+}
+
+// 请求行本身就超过上限时返回414, 否则431
+void HttpData::headerTooLarge(bool uri) {
+    metricAdd(M_EVICT_HEADER_TOO_LARGE, 1);
+    error_ = true;
+    if (uri)
+        handleError(fd_, 414, "URI Too Long");
+    else
+        handleError(fd_, 431, "Request Header Fields Too Large");
+}
+
+static bool parseContentLength(std::string_view value, uint64_t &length) {
+    if (value.empty() || value.size() > 19) return false;
+    length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return false;
+        length = length * 10 + (c - '0');
+    }
+    return true;
+}
+
+// 头部解析完后找到路由, 确定body的长度; 流式路由此时就调用handler创建BodySink,
+// 普通路由等body收完再调用. 出错时已经发送了错误响应, 返回false
+bool HttpData::beginRequest() {
+    std::string_view path(request_.target().data(), request_.path().size() + 1);
+    if (router_ == NULL || !router_->match(method_, path, match_)) {
+        if (router_ != NULL && router_->matchAnyMethod(path))
+            handleError(fd_, 405, "Method Not Allowed");
+        else
+            handleError(fd_, 404, "Not Found!");
+        return false;
+    }
+    // 同时出现Transfer-Encoding和Content-Length可能是请求走私, 直接拒绝
+    std::string_view te = request_.header(HDR_TRANSFER_ENCODING);
+    std::string_view cl = request_.header(HDR_CONTENT_LENGTH);
+    bool chunked = false;
+    uint64_t length = 0;
+    if (te.data() != NULL) {
+        if (cl.data() != NULL || HTTPVersion_ != HTTP_11) {
             handleError(fd_, 400, "Bad Request");
-            break;
+            return false;
         }
-        if (method_ == METHOD_POST) {
-            // POST方法准备
-            state_ = STATE_RECV_BODY;
-        } else {
-            state_ = STATE_ANALYSIS;
+        if (te.size() != 7 || strncasecmp(te.data(), "chunked", 7) != 0) {
+            handleError(fd_, 501, "Not Implemented");
+            return false;
         }
+        chunked = true;
+    } else if (cl.data() != NULL && !parseContentLength(cl, length)) {
+        handleError(fd_, 400, "Bad Request: invalid Content-Length");
+        return false;
+    }
+    if (match_.streamHandler == NULL && length > options_->maxBodySize) {
+        handleError(fd_, 413, "Payload Too Large");
+        return false;
+    }
+    // 客户端等待100 Continue后才发送body, 请求被拒绝时就不必发送了
+    std::string_view expect = request_.header(HDR_EXPECT);
+    bool expectContinue = false;
+    if (expect.data() != NULL && HTTPVersion_ == HTTP_11) {
+        if (expect.size() != 12 || strncasecmp(expect.data(), "100-continue", 12) != 0) {
+            handleError(fd_, 417, "Expectation Failed");
+            return false;
         }
-        if (state_ == STATE_RECV_BODY) {
-            int content_length = -1;
-            if (headers_.find("Content-length") != headers_.end()) {
-                content_length = stoi(headers_["Content-length"]);
-            } else {
-                // cout << "(state_ == STATE_RECV_BODY)" << endl;
-                error_ = true;
-                handleError(fd_, 400, "Bad Request: Lack of argument (Content-length)");
-                break;
-            }
-            if (static_cast<int>(inBuffer_.size()) < content_length) break;
-            state_ = STATE_ANALYSIS;
+        expectContinue = chunked || length > 0;
+    }
+
+    bodyDecoder_.reset(chunked, length);
+    if (match_.streamHandler != NULL) {
+        HttpRequest req(request_, match_, std::string_view());
+        HttpResponse resp(this);
+        shared_ptr<BodySink> sink = (*match_.streamHandler)(req, resp);
+        if (!sink) {
+            // 拒绝请求时必须调用sendError, 连接随即关闭, 不再读取body
+            assert(resp.failed());
+            if (!resp.failed()) handleError(fd_, 500, "Internal Server Error");
+            return false;
         }
-        if (state_ == STATE_ANALYSIS) {
-            AnalysisState flag = this->analysisRequest();
-        if (flag == ANALYSIS_SUCCESS) {
-            state_ = STATE_FINISH;
-            break;
-        } else {
-            // cout << "state_ == STATE_ANALYSIS" << endl;
+        assert(!resp.sent());
+        sink->conn_ = handle();
+        sink_ = sink;
+        state_ = STATE_RECV_BODY;
+    } else if (chunked) {
+        state_ = STATE_RECV_BODY;
+    } else {
+        bodyLength_ = length;
+        state_ = length > 0 ? STATE_RECV_BODY : STATE_ANALYSIS;
+    }
+    if (expectContinue) outBuffer_.appendStatic(kContinueResponse.data(), kContinueResponse.size());
+    if (state_ == STATE_RECV_BODY) bodyStart_ = monotonicMicros();
+    return true;
+}
+
+// 处理已经收到的body, 全部收完时返回true
+bool HttpData::receiveBody() {
+    size_t begin = nowReadPos_ + request_.headerLength();
+    // 普通路由的定长body留在原地, 收齐后直接交给handler
+    if (!sink_ && !bodyDecoder_.chunked()) return inBuffer_.size() - begin >= bodyLength_;
+    // 其余的body解码后立即从inBuffer_中删除, 头部保持不动
+    while (true) {
+        size_t skipped = 0;
+        std::string_view chunk;
+        BodyDecoder::Result result = bodyDecoder_.next(
+            inBuffer_.data() + begin, inBuffer_.size() - begin, &skipped, &chunk);
+        if (result == BodyDecoder::BODY_ERROR) {
+            handleError(fd_, 400, "Bad Request: malformed chunked body");
             error_ = true;
-            break;
-        }
+            return false;
         }
-    } while (false);
-    // cout << "state_=" << state_ << endl;
-    if (!error_) {
-        if (outBuffer_.size() > 0) {
-            handleWrite();
-            // events_ |= EPOLLOUT;
+        size_t used = 0;
+        if (result == BodyDecoder::BODY_DATA) {
+            if (sink_) {
+                used = sink_->onData(chunk);
+                if (used > chunk.size()) used = chunk.size();
+                if (sink_->rejectStatus_ != 0) {
+                    handleError(fd_, sink_->rejectStatus_, sink_->rejectReason_);
+                    error_ = true;
+                    return false;
+                }
+            } else if (body_.size() + chunk.size() > options_->maxBodySize) {
+                handleError(fd_, 413, "Payload Too Large");
+                error_ = true;
+                return false;
+            } else {
+                body_.append(chunk.data(), chunk.size());
+                used = chunk.size();
+            }
+            bodyDecoder_.consume(used);
         }
-        // error_ may change
-        if (!error_ && state_ == STATE_FINISH) {
-            this->reset();
-        if (inBuffer_.size() > 0) {
-            if (connectionState_ != H_DISCONNECTING) handleRead();
+        inBuffer_.erase(begin, skipped + used);
+        if (result == BodyDecoder::BODY_DONE) return true;
+        if (result == BodyDecoder::BODY_AGAIN) return false;
+        // BodySink没有全部用掉, 等它调用resume
+        if (used < chunk.size()) {
+            bodyPaused_ = true;
+            bodyPausedAt_ = monotonicMicros();
+            return false;
         }
-
-        // if ((keepAlive_ || inBuffer_.size() > 0) && connectionState_ ==
-        // H_CONNECTED)
-        // {
-        //     this->reset();
-        //     events_ |= EPOLLIN;
-        // }
-        } else if (!error_ && connectionState_ != H_DISCONNECTED)
-            events_ |= EPOLLIN;
     }
 }
 
-void HttpData::handleWrite() {
+// 流式路由的定长body, 缓存的部分已经交给onData, 剩下的可以由BodySink直接读
+bool HttpData::directBody() const {
+    return sink_ && state_ == STATE_RECV_BODY && !bodyDecoder_.chunked() &&
+        bodyDecoder_.remaining() > 0 && sink_->canReadFrom() &&
+        inBuffer_.size() == nowReadPos_ + request_.headerLength();
+}
+
+// BodySink::resume投递到IO线程执行
+void HttpData::resumeBody() {
+    if (!bodyPaused_ || error_ || connectionState_ == H_DISCONNECTED) return;
+    bodyPaused_ = false;
+    // 暂停的时间不算在body的期限内
+    bodyStart_ += monotonicMicros() - bodyPausedAt_;
+    resumeProcessing();
+}
+
+// 不是由epoll事件触发的继续处理: 先处理已经缓存的数据, 可以读时再从socket读,
+// 最后重新设置关注的事件. 缓存的body全部用掉之后才读, 所以不超过readChunkSize
+void HttpData::resumeProcessing() {
+    channel_.setEvents(0);
+    if (pipelinePaused_ && pipelineDrained()) lowWaterMark();
+    processPipeline();
+    if (!error_ && !bodyPaused_ && !stream_ && !fileWait_)
+        handleRead();
+    else if (!error_ && !outBuffer_.empty())
+        flushOutput();
+    handleConn();
+}
+
+// 排队期间不关注EPOLLIN, 同一个连接不会既由epoll又由就绪队列触发
+void HttpData::deferRead() {
+    readDeferred_ = true;
+    metricAdd(M_READ_DEFERRALS, 1);
+    Ref<HttpData> self(this);
+    loop_->queueReady([self] { self->readReady(); });
+}
+
+void HttpData::readReady() {
+    readDeferred_ = false;
+    if (error_ || connectionState_ == H_DISCONNECTED) return;
+    resumeProcessing();
+}
+
+// 流式响应的数据在本轮事件循环的最后统一发送, 多次write合并成一次sendmsg
+void HttpData::scheduleFlush() {
+    if (flushQueued_) return;
+    flushQueued_ = true;
+    Ref<HttpData> self(this);
+    loop_->queueInLoop([self] { self->flushQueued(); });
+}
+
+void HttpData::flushQueued() {
+    flushQueued_ = false;
+    if (error_ || connectionState_ == H_DISCONNECTED) return;
+    resumeProcessing();
+}
+
+// 流式响应结束, 继续处理后面的请求
+void HttpData::endStream(bool shutdown) {
+    stream_.reset();
+    if (shutdown) shutdownAfterFlush_ = true;
+    scheduleFlush();
+}
+
+// 延迟的响应以错误页面结束(已经由handleError发出), 关闭连接
+void HttpData::abortStream() {
+    stream_.reset();
+    error_ = true;
+    handleConn();
+}
+
+void HttpData::flushOutput() {
     if (!error_ && connectionState_ != H_DISCONNECTED) {
-        __uint32_t &events_ = channel_->getEvents();
-        if (writen(fd_, outBuffer_) < 0) {
-            perror("writen");
+        __uint32_t &events_ = channel_.getEvents();
+        if (outBuffer_.flush(fd_) < 0) {
+            perror("writev");
             events_ = 0;
             error_ = true;
-        }
-        if (outBuffer_.size() > 0) {events_ |= EPOLLOUT; return;}
-        if (src_addr_ == 0)
+            outBuffer_.clear();
             return;
-        int n;
-        if (n = writen(fd_, (char*)(src_addr_)+src_transferred_, src_size_-src_transferred_) < 0) {
-            perror("writen");
-            events_ = 0;
-            error_ = true;
-            munmap(src_addr_, src_size_);
-            src_addr_ = 0;
-            src_size_ = src_transferred_ = 0;
         }
-        src_transferred_ += n;
-        if (src_transferred_ < src_size_) {events_ |= EPOLLOUT; return;}
-        munmap(src_addr_, src_size_);
-        src_addr_ = 0;
-        src_size_ = 0;
-        src_transferred_ = 0;
+        if (outBuffer_.empty()) {
+            pendingResponses_ = 0;
+            if (shutdownAfterFlush_) shutDownWR(fd_);
+        } else {
+            events_ |= EPOLLOUT;
+        }
+        // 暂停的流式响应降到低水位以下, 回调中可能结束响应
+        if (stream_ && stream_->blocked_ &&
+            outBuffer_.bytes() < options_->outputLowWaterMark) {
+            shared_ptr<ResponseWriter> stream(stream_);
+            stream->notify();
+        }
     }
 }
 
+void HttpData::handleWrite() {
+    flushOutput();
+    // 降到低水位以下后恢复被暂停的流水线
+    if (!error_ && pipelinePaused_ && pipelineDrained()) {
+        lowWaterMark();
+        handleRead();
+    }
+}
+
+// EPOLLERR或没有数据可读的EPOLLHUP: 连接已经不可用, 直接关闭并释放缓冲区
+void HttpData::handleReset() {
+    error_ = true;
+    handleConn();
+}
+
 //not use
 void HttpData::handleConn() {
+    if (idle()) compact();
+    updateMetrics();
     seperateTimer();
-    __uint32_t &events_ = channel_->getEvents();
+    __uint32_t &events_ = channel_.getEvents();
     if (!error_ && connectionState_ == H_CONNECTED) {
         if (events_ != 0) {
-            int timeout = DEFAULT_EXPIRED_TIME;
-            if (keepAlive_) timeout = DEFAULT_KEEP_ALIVE_TIME;
+            int timeout = nextTimeout();
             if ((events_ & EPOLLIN) && (events_ & EPOLLOUT)) {
                 events_ = __uint32_t(0);
                 events_ |= EPOLLOUT;
             }
             // events_ |= (EPOLLET | EPOLLONESHOT);
             events_ |= EPOLLET;
-            loop_->updatePoller(channel_, timeout);
+            loop_->updatePoller(&channel_, timeout);
 
+        } else if (bodyPaused_ || stream_ || readDeferred_ || fileWait_) {
+            // 等待BodySink::resume, 流式响应的数据, 就绪队列或FileLoader, 期间不关心可读事件
+            events_ = EPOLLET;
+            loop_->updatePoller(&channel_, nextTimeout());
         } else if (keepAlive_) {
             events_ |= (EPOLLIN | EPOLLET);
             // events_ |= (EPOLLIN | EPOLLET | EPOLLONESHOT);
-            int timeout = DEFAULT_KEEP_ALIVE_TIME;
-            loop_->updatePoller(channel_, timeout);
+            loop_->updatePoller(&channel_, nextTimeout());
         } else {
             // cout << "close normally" << endl;
             // loop_->shutdown(channel_);
-            // loop_->runInLoop(bind(&HttpData::handleClose, shared_from_this()));
+            // handleClose();
             events_ |= (EPOLLIN | EPOLLET);
             // events_ |= (EPOLLIN | EPOLLET | EPOLLONESHOT);
-            int timeout = (DEFAULT_KEEP_ALIVE_TIME >> 1);
-            loop_->updatePoller(channel_, timeout);
+            loop_->updatePoller(&channel_, nextTimeout());
         }
     } else if (!error_ && connectionState_ == H_DISCONNECTING &&
-                (events_ & EPOLLOUT)) {
-        events_ = (EPOLLOUT | EPOLLET);
+                ((events_ & EPOLLOUT) || bodyPaused_ || stream_ || fileWait_)) {
+        // 对端已关闭写端, 发完剩余的响应(或等BodySink处理完已经收到的body)再关闭
+        events_ = (events_ & EPOLLOUT) | EPOLLET;
+        loop_->updatePoller(&channel_, nextTimeout());
     } else {
         // cout << "close with errors" << endl;
-        loop_->runInLoop(bind(&HttpData::handleClose, shared_from_this()));
+        handleClose();
     }
 }
 
-URIState HttpData::parseURI() {
-    string &str = inBuffer_;
-    // 读到完整的请求行再开始解析请求
-    size_t pos = str.find('\r', nowReadPos_);
-    if (pos < 0) {
-        return PARSE_URI_AGAIN;
-    }
-    // 去掉请求行所占的空间，节省空间
-    string request_line = str.substr(0, pos);
-    if (str.size() > pos + 1)
-        str = str.substr(pos + 1);
-    else
-        str.clear();
-    // Method
-    int posGet = request_line.find("GET");
-    int posPost = request_line.find("POST");
-    int posHead = request_line.find("HEAD");
-
-    if (posGet >= 0) {
-        pos = posGet;
-        method_ = METHOD_GET;
-    } else if (posPost >= 0) {
-        pos = posPost;
-        method_ = METHOD_POST;
-    } else if (posHead >= 0) {
-        pos = posHead;
-        method_ = METHOD_HEAD;
+// 当前阶段的截止时间距现在的毫秒数, 同时记下超时的原因. 各阶段的截止时间从阶段开始时算起,
+// 每次事件后重新设置定时器也不会因为收到部分数据而推迟; 只有等待对端接收响应时按进展计时
+int HttpData::nextTimeout() {
+    int64_t now = monotonicMicros();
+    int64_t deadline;
+    if (state_ == STATE_RECV_BODY && !bodyPaused_) {
+        // 按最低速率, 已经收到的数据换来相应的时间
+        deadline = bodyStart_ + options_->bodyTimeoutMs * 1000LL;
+        if (options_->minBodyRate > 0)
+            deadline += static_cast<int64_t>(bodyReceived() * 1000000 / options_->minBodyRate);
+        timeoutReason_ = M_EVICT_BODY;
+    } else if (state_ == STATE_PARSE_REQUEST && !pipelinePaused_ &&
+               (requestStart_ != 0 || inBuffer_.size() > nowReadPos_)) {
+        if (requestStart_ == 0) requestStart_ = now;
+        if (request_.requestLineDone()) {
+            deadline = requestStart_ + options_->headerTimeoutMs * 1000LL;
+            timeoutReason_ = M_EVICT_HEADERS;
+        } else {
+            deadline = requestStart_ + options_->requestLineTimeoutMs * 1000LL;
+            timeoutReason_ = M_EVICT_REQUEST_LINE;
+        }
+    } else if (!outBuffer_.empty() || stream_ || bodyPaused_ || pipelinePaused_ || fileWait_) {
+        deadline = now + options_->responseTimeoutMs * 1000LL;
+        timeoutReason_ = M_EVICT_RESPONSE;
     } else {
-        return PARSE_URI_ERROR;
+        deadline = idleStart_ + options_->keepAliveTimeoutMs * 1000LL;
+        timeoutReason_ = M_EVICT_IDLE;
     }
+    int64_t ms = (deadline - now + 999) / 1000;
+    if (ms < 1) return 1;
+    return ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+}
 
-    // filename
-    pos = request_line.find("/", pos);
-    if (pos < 0) {
-        fileName_ = "index.html";
-        HTTPVersion_ = HTTP_11;
-        return PARSE_URI_SUCCESS;
-    } else {
-        size_t _pos = request_line.find(' ', pos);
-        if (_pos < 0)
-            return PARSE_URI_ERROR;
-        else {
-        if (_pos - pos > 1) {
-            fileName_ = request_line.substr(pos + 1, _pos - pos - 1);
-            size_t __pos = fileName_.find('?');
-            if (__pos >= 0) {
-                fileName_ = fileName_.substr(0, __pos);
-            }
-        }
+// 已经收到的body字节数, 普通路由的定长body留在inBuffer_中没有经过BodyDecoder
+uint64_t HttpData::bodyReceived() const {
+    if (sink_ || bodyDecoder_.chunked()) return bodyDecoder_.received();
+    size_t begin = nowReadPos_ + request_.headerLength();
+    return inBuffer_.size() > begin ? inBuffer_.size() - begin : 0;
+}
 
-        else
-            fileName_ = "index.html";
-        }
-        pos = _pos;
-    }
-    // cout << "fileName_: " << fileName_ << endl;
-    // HTTP 版本号
-    pos = request_line.find("/", pos);
-    if (pos < 0)
-        return PARSE_URI_ERROR;
-    else {
-        if (request_line.size() - pos <= 3)
-            return PARSE_URI_ERROR;
-        else {
-            string ver = request_line.substr(pos + 1, 3);
-            if (ver == "1.0")
-                HTTPVersion_ = HTTP_10;
-            else if (ver == "1.1")
-                HTTPVersion_ = HTTP_11;
-            else
-                return PARSE_URI_ERROR;
-        }
+// 定时器到期, 按所处的阶段计数后关闭
+void HttpData::handleTimeout() {
+    timer_ = NULL;
+    metricAdd(timeoutReason_, 1);
+    handleClose();
+}
+
+static bool parseRangeNumber(const char *&p, const char *end, off_t &value) {
+    if (p == end || *p < '0' || *p > '9') return false;
+    value = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+        if (value > (LLONG_MAX - 9) / 10) return false;
+        value = value * 10 + (*p - '0');
+        ++p;
     }
-    return PARSE_URI_SUCCESS;
-}
-
-HeaderState HttpData::parseHeaders() {
-    string &str = inBuffer_;
-    int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
-    int now_read_line_begin = 0;
-    bool notFinish = true;
-    size_t i = 0;
-    for (; i < str.size() && notFinish; ++i) {
-        switch (hState_) {
-        case H_START: {
-            if (str[i] == '\n' || str[i] == '\r') break;
-            hState_ = H_KEY;
-            key_start = i;
-            now_read_line_begin = i;
-            break;
-        }
-        case H_KEY: {
-            if (str[i] == ':') {
-                key_end = i;
-                if (key_end - key_start <= 0) return PARSE_HEADER_ERROR;
-                hState_ = H_COLON;
-            } else if (str[i] == '\n' || str[i] == '\r')
-                return PARSE_HEADER_ERROR;
-            break;
-        }
-        case H_COLON: {
-            if (str[i] == ' ') {
-                hState_ = H_SPACES_AFTER_COLON;
-            } else
-                return PARSE_HEADER_ERROR;
-            break;
-        }
-        case H_SPACES_AFTER_COLON: {
-            hState_ = H_VALUE;
-            value_start = i;
-            break;
-        }
-        case H_VALUE: {
-            if (str[i] == '\r') {
-                hState_ = H_CR;
-                value_end = i;
-                if (value_end - value_start <= 0) return PARSE_HEADER_ERROR;
-            } else if (i - value_start > 255)
-                return PARSE_HEADER_ERROR;
-            break;
-        }
-        case H_CR: {
-            if (str[i] == '\n') {
-                hState_ = H_LF;
-                string key(str.begin() + key_start, str.begin() + key_end);
-                string value(str.begin() + value_start, str.begin() + value_end);
-                headers_[key] = value;
-                now_read_line_begin = i;
-            } else
-                return PARSE_HEADER_ERROR;
-            break;
-        }
-        case H_LF: {
-            if (str[i] == '\r') {
-                hState_ = H_END_CR;
-            } else {
-                key_start = i;
-                hState_ = H_KEY;
-            }
-            break;
-        }
-        case H_END_CR: {
-            if (str[i] == '\n') {
-                hState_ = H_END_LF;
-            } else
-                return PARSE_HEADER_ERROR;
-            break;
-        }
-        case H_END_LF: {
-            notFinish = false;
-            key_start = i;
-            now_read_line_begin = i;
-            break;
+    return true;
+}
+
+// 解析 Range: bytes=a-b, c-, -n, 结果为闭区间
+// 返回-1表示不合法(忽略Range), 0表示没有可满足的区间, 否则为区间数
+static int parseRange(std::string_view value, off_t size,
+                      vector<pair<off_t, off_t>> &ranges) {
+    const char *p = value.data();
+    const char *end = p + value.size();
+    if (value.size() < 6 || strncasecmp(p, "bytes=", 6) != 0) return -1;
+    p += 6;
+    int count = 0;
+    while (true) {
+        while (p != end && (*p == ' ' || *p == '\t')) ++p;
+        off_t first = 0, last = 0;
+        bool has_first = parseRangeNumber(p, end, first);
+        if (p == end || *p != '-') return -1;
+        ++p;
+        bool has_last = parseRangeNumber(p, end, last);
+        if (!has_first && !has_last) return -1;
+        if (++count > MAX_RANGES) return -1;
+        if (!has_first) {
+            // 后缀区间: 最后last个字节
+            if (last > 0 && size > 0)
+                ranges.push_back(make_pair(last < size ? size - last : 0, size - 1));
+        } else {
+            if (has_last && last < first) return -1;
+            if (first < size)
+                ranges.push_back(
+                    make_pair(first, (!has_last || last >= size) ? size - 1 : last));
         }
+        while (p != end && (*p == ' ' || *p == '\t')) ++p;
+        if (p == end) break;
+        if (*p != ',') return -1;
+        ++p;
+    }
+    return static_cast<int>(ranges.size());
+}
+
+// If-None-Match中的etag列表使用弱比较
+static bool etagListMatches(std::string_view list, std::string_view etag) {
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == string::npos) end = list.size();
+        size_t b = pos, e = end;
+        while (b < e && (list[b] == ' ' || list[b] == '\t')) ++b;
+        while (e > b && (list[e - 1] == ' ' || list[e - 1] == '\t')) --e;
+        if (e - b == 1 && list[b] == '*') return true;
+        if (e - b > 2 && list.compare(b, 2, "W/") == 0) b += 2;
+        if (list.substr(b, e - b) == etag) return true;
+        pos = end + 1;
     }
+    return false;
+}
+
+static bool parseHttpDate(std::string_view value, time_t &t) {
+    char buf[64];
+    if (value.size() >= sizeof buf) return false;
+    memcpy(buf, value.data(), value.size());
+    buf[value.size()] = '\0';
+    struct tm tm_time;
+    memset(&tm_time, 0, sizeof tm_time);
+    const char *end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm_time);
+    if (end == NULL) return false;
+    t = timegm(&tm_time);
+    return true;
+}
+
+// Accept-Encoding中有gzip(或*)且q不为0
+static bool acceptsGzip(std::string_view list) {
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == string::npos) end = list.size();
+        std::string_view item = list.substr(pos, end - pos);
+        size_t semi = item.find(';');
+        std::string_view coding = item.substr(0, semi);
+        while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t'))
+            coding.remove_prefix(1);
+        while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t'))
+            coding.remove_suffix(1);
+        if ((coding.size() == 4 && strncasecmp(coding.data(), "gzip", 4) == 0) ||
+            coding == "*") {
+            if (semi == string::npos) return true;
+            size_t q = item.find("q=", semi);
+            if (q == string::npos || strtod(string(item.substr(q + 2)).c_str(), NULL) > 0)
+                return true;
+        }
+        pos = end + 1;
     }
-    if (hState_ == H_END_LF) {
-        str = str.substr(i);
-        return PARSE_HEADER_SUCCESS;
+    return false;
+}
+
+// 编译进程序的资源: 预先生成了除通用头部外的全部内容, 不访问文件系统
+AnalysisState HttpData::serveAsset(const Asset &asset) {
+    HeaderWriter header;
+    std::string_view ifNoneMatch = request_.header(HDR_IF_NONE_MATCH);
+    bool gzip = !asset.gzipResponse.empty() &&
+        acceptsGzip(request_.header(HDR_ACCEPT_ENCODING));
+    std::string_view etag = gzip ? asset.gzipEtag : asset.etag;
+    std::string_view response = gzip ? asset.gzipResponse : asset.response;
+    size_t headerLength = gzip ? asset.gzipHeaderLength : asset.headerLength;
+    if (ifNoneMatch.data() != NULL && etagListMatches(ifNoneMatch, etag)) {
+        writeCommonHeaders(header, kStatus304);
+        header << "ETag: " << etag << "\r\n\r\n";
+        outBuffer_.append(header.data(), header.size());
+        return ANALYSIS_SUCCESS;
     }
-    str = str.substr(now_read_line_begin);
-    return PARSE_HEADER_AGAIN;
+    writeCommonHeaders(header, kStatus200);
+    outBuffer_.append(header.data(), header.size());
+    outBuffer_.appendStatic(response.data(),
+                            method_ == METHOD_HEAD ? headerLength : response.size());
+    return ANALYSIS_SUCCESS;
+}
+
+// 条件请求, If-None-Match优先于If-Modified-Since
+bool HttpData::notModified(const FileInfo &info) {
+    std::string_view value = request_.header(HDR_IF_NONE_MATCH);
+    if (value.data() != NULL) return etagListMatches(value, info.etag);
+    value = request_.header(HDR_IF_MODIFIED_SINCE);
+    if (value.empty()) return false;
+    // 浏览器通常原样带回Last-Modified, 先比较字符串避免解析日期
+    if (value == info.lastModified) return true;
+    time_t since;
+    return parseHttpDate(value, since) && info.mtime <= since;
+}
+
+// If-Range与当前校验值不一致时忽略Range, 返回整个文件
+bool HttpData::rangeApplies(const FileInfo &info) {
+    std::string_view value = request_.header(HDR_IF_RANGE);
+    if (value.data() == NULL) return true;
+    if (!value.empty() && value[0] == '"') return value == info.etag;
+    return value == info.lastModified;
 }
 
+// 调用beginRequest找到的普通路由的handler
 AnalysisState HttpData::analysisRequest() {
-    if (method_ == METHOD_POST) {
-        // ------------------------------------------------------
-        // My CV stitching handler which requires OpenCV library
-        // ------------------------------------------------------
-        // string header;
-        // header += string("HTTP/1.1 200 OK\r\n");
-        // if(headers_.find("Connection") != headers_.end() &&
-        // headers_["Connection"] == "Keep-Alive")
-        // {
-        //     keepAlive_ = true;
-        //     header += string("Connection: Keep-Alive\r\n") + "Keep-Alive:
-        //     timeout=" + to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
-        // }
-        // int length = stoi(headers_["Content-length"]);
-        // vector<char> data(inBuffer_.begin(), inBuffer_.begin() + length);
-        // Mat src = imdecode(data, CV_LOAD_IMAGE_ANYDEPTH|CV_LOAD_IMAGE_ANYCOLOR);
-        // //imwrite("receive.bmp", src);
-        // Mat res = stitch(src);
-        // vector<uchar> data_encode;
-        // imencode(".png", res, data_encode);
-        // header += string("Content-length: ") + to_string(data_encode.size()) +
-        // "\r\n\r\n";
-        // outBuffer_ += header + string(data_encode.begin(), data_encode.end());
-        // inBuffer_ = inBuffer_.substr(length);
-        // return ANALYSIS_SUCCESS;
-    } else if (method_ == METHOD_GET || method_ == METHOD_HEAD) {
-        string header;
-        header += "HTTP/1.1 200 OK\r\n";
-        if (headers_.find("Connection") != headers_.end() &&
-            (headers_["Connection"] == "Keep-Alive" ||
-            headers_["Connection"] == "keep-alive")) {
-            keepAlive_ = true;
-            header += string("Connection: Keep-Alive\r\n") + "Keep-Alive: timeout=" +
-                to_string(DEFAULT_KEEP_ALIVE_TIME) + "\r\n";
-        }
-        int dot_pos = fileName_.find('.');
-        string filetype;
-        if (dot_pos < 0)
-            filetype = MimeType::getMime("default");
-        else
-            filetype = MimeType::getMime(fileName_.substr(dot_pos));
+    std::string_view body = bodyDecoder_.chunked()
+        ? std::string_view(body_)
+        : std::string_view(inBuffer_.data() + nowReadPos_ + request_.headerLength(), bodyLength_);
+    HttpRequest req(request_, match_, body);
+    HttpResponse resp(this);
+    (*match_.handler)(req, resp);
+    if (!resp.sent()) {
+        handleError(fd_, 500, "Internal Server Error");
+        return ANALYSIS_ERROR;
+    }
+    return resp.failed() ? ANALYSIS_ERROR : ANALYSIS_SUCCESS;
+}
 
-        // echo test
-        if (fileName_ == "hello") {
-            outBuffer_ =
-                "HTTP/1.1 200 OK\r\nContent-type: text/plain\r\n\r\nHello World";
-            return ANALYSIS_SUCCESS;
-        }
-        if (fileName_ == "favicon.ico") {
-            header += "Content-Type: image/png\r\n";
-            header += "Content-Length: " + to_string(sizeof favicon) + "\r\n";
-            header += "Server: Ekko's Web Server\r\n";
-
-            header += "\r\n";
-            outBuffer_ += header;
-            outBuffer_ += string(favicon, favicon + sizeof favicon);
-            return ANALYSIS_SUCCESS;
-        }
+// 流式路由的body接收完毕, 由BodySink发送响应
+AnalysisState HttpData::finishStream() {
+    shared_ptr<BodySink> sink;
+    sink.swap(sink_);
+    HttpResponse resp(this);
+    sink->onEnd(resp);
+    if (!resp.sent()) {
+        handleError(fd_, 500, "Internal Server Error");
+        return ANALYSIS_ERROR;
+    }
+    return resp.failed() ? ANALYSIS_ERROR : ANALYSIS_SUCCESS;
+}
 
-        struct stat sbuf;
-        if (stat(fileName_.c_str(), &sbuf) < 0) {
-            header.clear();
-            handleError(fd_, 404, "Not Found!");
-            return ANALYSIS_ERROR;
-        }
-        header += "Content-Type: " + filetype + "\r\n";
-        header += "Content-Length: " + to_string(sbuf.st_size) + "\r\n";
-        header += "Server: Ekko's Web Server\r\n";
-        // 头部结束
-        header += "\r\n";
-        outBuffer_ += header;
+// 只允许网站目录下的相对路径: 不能以'/'开头(如"GET //etc/passwd"中通配符匹配到的"/etc/passwd"),
+// 不能有空的段和".."段, 不能含NUL
+static bool safePath(std::string_view path) {
+    if (path.find('\0') != std::string_view::npos) return false;
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string_view::npos) end = path.size();
+        std::string_view segment = path.substr(pos, end - pos);
+        if (segment.empty() || segment == "..") return false;
+        pos = end + 1;
+    }
+    return true;
+}
 
-        if (method_ == METHOD_HEAD) return ANALYSIS_SUCCESS;
+// 静态文件, 资源优先, 其次是网站目录下的文件; path不含开头的'/'
+AnalysisState HttpData::serveFile(std::string_view path) {
+    if (method_ != METHOD_GET && method_ != METHOD_HEAD) {
+        handleError(fd_, 405, "Method Not Allowed");
+        return ANALYSIS_ERROR;
+    }
+    if (!safePath(path)) {
+        handleError(fd_, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    const Asset *asset = findAsset(path);
+    if (asset != NULL) return serveAsset(*asset);
 
-        int src_fd = open(fileName_.c_str(), O_RDONLY, 0);
-        if (src_fd < 0) {
-            outBuffer_.clear();
-            handleError(fd_, 404, "Not Found!");
-            return ANALYSIS_ERROR;
-        }
-        void *mmapRet = mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-        close(src_fd);
-        if (mmapRet == (void *)-1) {
-            munmap(mmapRet, sbuf.st_size);
-            outBuffer_.clear();
-            handleError(fd_, 404, "Not Found!");
-            return ANALYSIS_ERROR;
+    fileName_.assign(path.data(), path.size());
+    // 本线程没有访问过的文件可能不在页缓存中, stat和读盘交给FileLoader, 不阻塞其它连接
+    FileLoader *loader = loop_->fileLoader();
+    if (loader != NULL && !loop_->fileCache().contains(fileName_)) {
+        loadFile(loader);
+        return ANALYSIS_SUCCESS;
+    }
+    return serveCachedFile();
+}
+
+// 同一路径并发的请求共享一次加载; 结果先存入本线程的FileCache, 连接还在时继续处理
+void HttpData::loadFile(FileLoader *loader) {
+    fileWait_ = true;
+    ConnectionHandle conn = handle();
+    loader->load(loop_, fileName_, [conn](const string &path, const FileLoader::Result &result) {
+        conn.loop->fileCache().store(path, result.err == 0 ? &result.st : NULL);
+        HttpData *c = conn.get();
+        if (c == NULL) return;
+        Ref<HttpData> guard(c);
+        c->fileLoaded();
+    });
+}
+
+void HttpData::fileLoaded() {
+    if (!fileWait_ || error_ || connectionState_ == H_DISCONNECTED) return;
+    fileWait_ = false;
+    resumeProcessing();
+}
+
+// fileName_的元数据来自FileCache: 缓存过的文件在这里stat, 否则是FileLoader刚存入的结果
+AnalysisState HttpData::serveCachedFile() {
+    HeaderWriter header;
+    std::string_view filetype = MimeType::forPath(fileName_);
+
+    // 元数据和校验值来自本loop的FileCache, 命中时没有系统调用
+    const FileInfo &info = loop_->fileCache().lookup(fileName_);
+    if (!info.regular) {
+        handleError(fd_, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    off_t file_size = info.size;
+
+    if (notModified(info)) {
+        writeCommonHeaders(header, kStatus304);
+        header << "ETag: " << info.etag << "\r\nLast-Modified: " << info.lastModified
+               << "\r\n\r\n";
+        outBuffer_.append(header.data(), header.size());
+        return ANALYSIS_SUCCESS;
+    }
+
+    vector<pair<off_t, off_t>> ranges;
+    int range_num = -1;
+    std::string_view range = request_.header(HDR_RANGE);
+    if (range.data() != NULL && rangeApplies(info))
+        range_num = parseRange(range, file_size, ranges);
+    if (range_num == 0) {
+        writeCommonHeaders(header, kStatus416);
+        header << "ETag: " << info.etag << "\r\nLast-Modified: " << info.lastModified
+               << "\r\nContent-Range: bytes */" << file_size
+               << "\r\nContent-Length: 0\r\n\r\n";
+        outBuffer_.append(header.data(), header.size());
+        return ANALYSIS_SUCCESS;
+    }
+
+    // 响应体: 依次是每段的head和文件的[offset, offset + length)
+    struct FilePart {
+        string head;
+        off_t offset;
+        size_t length;
+    };
+    vector<FilePart> parts;
+    off_t content_length = file_size;
+    writeCommonHeaders(header, range_num > 0 ? kStatus206 : kStatus200);
+    header << "ETag: " << info.etag << "\r\nLast-Modified: " << info.lastModified << "\r\n";
+    if (range_num == 1) {
+        // 单区间直接返回该区间
+        content_length = ranges[0].second - ranges[0].first + 1;
+        header << "Content-Type: " << filetype << "\r\nContent-Range: bytes "
+               << ranges[0].first << '-' << ranges[0].second << '/' << file_size << "\r\n";
+        FilePart part;
+        part.offset = ranges[0].first;
+        part.length = content_length;
+        parts.push_back(part);
+    } else if (range_num > 1) {
+        // 多区间使用multipart/byteranges, 每个区间前加分段头
+        string boundary = "ekko_byteranges_" + to_string(++t_boundarySeq);
+        header << "Content-Type: multipart/byteranges; boundary=" << boundary << "\r\n";
+        content_length = 0;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            FilePart part;
+            part.head = "\r\n--" + boundary + "\r\nContent-Type: " + string(filetype) +
+                "\r\nContent-Range: bytes " + to_string(ranges[i].first) + "-" +
+                to_string(ranges[i].second) + "/" + to_string(file_size) +
+                "\r\n\r\n";
+            part.offset = ranges[i].first;
+            part.length = ranges[i].second - ranges[i].first + 1;
+            content_length += part.head.size() + part.length;
+            parts.push_back(part);
         }
-        src_addr_ = mmapRet;
-        src_size_ = sbuf.st_size;
-        /*outBuffer_ += string(src_addr, src_addr + sbuf.st_size);
-        munmap(mmapRet, sbuf.st_size);*/
+        FilePart tail;
+        tail.head = "\r\n--" + boundary + "--\r\n";
+        tail.offset = 0;
+        tail.length = 0;
+        content_length += tail.head.size();
+        parts.push_back(tail);
+    } else {
+        header << "Content-Type: " << filetype << "\r\n" << kAcceptRangesHeader;
+        FilePart part;
+        part.offset = 0;
+        part.length = file_size;
+        parts.push_back(part);
+    }
+    // 头部结束
+    header << "Content-Length: " << content_length << "\r\n\r\n";
+
+    if (method_ == METHOD_HEAD || file_size == 0) {
+        outBuffer_.append(header.data(), header.size());
         return ANALYSIS_SUCCESS;
     }
-    return ANALYSIS_ERROR;
+
+    int src_fd = open(fileName_.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (src_fd < 0) {
+        handleError(fd_, 404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    // 不再整体mmap, 发送时按窗口映射
+    shared_ptr<MappedFile> file(new MappedFile(src_fd, file_size));
+    outBuffer_.append(header.data(), header.size());
+    for (auto &part : parts) {
+        outBuffer_.append(std::move(part.head));
+        outBuffer_.appendFile(file, part.offset, part.length);
+    }
+    return ANALYSIS_SUCCESS;
+}
+
+// 状态行, Date, Server和长连接相关的头部
+void HttpData::writeCommonHeaders(HeaderWriter &header, std::string_view status) {
+    header << status << loop_->dateLine() << kServerHeader;
+    if (keepAlive_) writeKeepAliveHeaders(header);
+}
+
+void HttpData::writeCommonHeaders(HeaderWriter &header, int status, std::string_view reason) {
+    header << "HTTP/1.1 " << status << ' ' << reason << "\r\n" << loop_->dateLine()
+           << kServerHeader;
+    if (keepAlive_) writeKeepAliveHeaders(header);
+}
+
+// Keep-Alive的timeout以秒为单位
+void HttpData::writeKeepAliveHeaders(HeaderWriter &header) {
+    header << "Connection: Keep-Alive\r\nKeep-Alive: timeout=" << options_->keepAliveTimeoutMs / 1000
+           << "\r\n";
 }
 
 void HttpData::handleError(int fd, int err_num, string short_msg) {
-    short_msg = " " + short_msg;
-    char send_buff[4096];
-    string body_buff, header_buff;
+    string body_buff;
     body_buff += "<html><title>哎~出错了</title>";
     body_buff += "<body bgcolor=\"ffffff\">";
-    body_buff += to_string(err_num) + short_msg;
+    body_buff += to_string(err_num) + " " + short_msg;
     body_buff += "<hr><em> Ekko's Web Server</em>\n</body></html>";
 
-    header_buff += "HTTP/1.1 " + to_string(err_num) + short_msg + "\r\n";
-    header_buff += "Content-Type: text/html\r\n";
-    header_buff += "Connection: Close\r\n";
-    header_buff += "Content-Length: " + to_string(body_buff.size()) + "\r\n";
-    header_buff += "Server: Ekko's Web Server\r\n";
-    ;
-    header_buff += "\r\n";
-    // 错误处理不考虑writen不完的情况
-    sprintf(send_buff, "%s", header_buff.c_str());
-    writen(fd, send_buff, strlen(send_buff));
-    sprintf(send_buff, "%s", body_buff.c_str());
-    writen(fd, send_buff, strlen(send_buff));
+    HeaderWriter header;
+    header << "HTTP/1.1 " << err_num << ' ' << short_msg << "\r\n" << loop_->dateLine()
+           << kServerHeader << kCloseHeader << "Content-Type: text/html\r\nContent-Length: "
+           << body_buff.size() << "\r\n\r\n";
+    // sendError传入的reason过长
+    if (header.overflowed()) return handleError(fd, 500, "Internal Server Error");
+    // 错误处理不考虑写不完的情况, 头部和body合并成一次writev
+    // 队列中之前的响应会先于错误响应发出
+    outBuffer_.append(header.data(), header.size());
+    outBuffer_.append(std::move(body_buff));
+    outBuffer_.flush(fd);
+    outBuffer_.clear();
 }
 
 void HttpData::handleClose() {
     connectionState_ = H_DISCONNECTED;
-    shared_ptr<HttpData> guard(shared_from_this());
-    loop_->removeFromPoller(channel_);
+    // poller的引用可能是最后一个
+    Ref<HttpData> guard(this);
+    loop_->removeFromPoller(&channel_);
 }
 
 void HttpData::newEvent() {
-    channel_->setEvents(DEFAULT_EVENT);
-    loop_->addToPoller(channel_, DEFAULT_EXPIRED_TIME);
-}
\ No newline at end of file
+    channel_.setEvents(DEFAULT_EVENT);
+    loop_->addToPoller(&channel_, nextTimeout());
+}
+
+void HttpData::create(EventLoop *loop, int connfd, uint32_t peerAddr, const Router *router,
+                      const HttpOptions *options) {
+    Ref<HttpData> conn(new HttpData(loop, connfd, peerAddr, router, options));
+    conn->newEvent();
+}
+
+HttpData *ConnectionHandle::get() const { return loop->findConnection(fd, id); }
\ No newline at end of file
@@ -1,115 +1,190 @@
 #pragma once
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <atomic>
 #include <functional>
-#include <map>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include "Channel.h"
+#include "ConnectionHandle.h"
+#include "HttpParser.h"
+#include "Metrics.h"
+#include "OutputQueue.h"
+#include "Ref.h"
+#include "Router.h"
 #include "Timer.h"
 
 
 class EventLoop;
 class TimerNode;
-class Channel;
+struct FileInfo;
+class FileLoader;
+struct Asset;
+class HeaderWriter;
+class BodySink;
+class ResponseWriter;
+struct HttpOptions;
 
 enum ProcessState {
-    STATE_PARSE_URI = 1,
-    STATE_PARSE_HEADERS,
+    STATE_PARSE_REQUEST = 1,
     STATE_RECV_BODY,
     STATE_ANALYSIS,
+    // handler已经调用sendFile, 等待FileLoader加载文件的元数据
+    STATE_WAIT_FILE,
     STATE_FINISH
 };
 
-enum URIState {
-    PARSE_URI_AGAIN = 1,
-    PARSE_URI_ERROR,
-    PARSE_URI_SUCCESS,
-};
-
-enum HeaderState {
-    PARSE_HEADER_SUCCESS = 1,
-    PARSE_HEADER_AGAIN,
-    PARSE_HEADER_ERROR
-};
-
 enum AnalysisState { ANALYSIS_SUCCESS = 1, ANALYSIS_ERROR };
 
-enum ParseState {
-  H_START = 0,
-  H_KEY,
-  H_COLON,
-  H_SPACES_AFTER_COLON,
-  H_VALUE,
-  H_CR,
-  H_LF,
-  H_END_CR,
-  H_END_LF
-};
-
 enum ConnectionState { H_CONNECTED = 0, H_DISCONNECTING, H_DISCONNECTED };
 
-enum HttpMethod { METHOD_POST = 1, METHOD_GET, METHOD_HEAD };
-
-enum HttpVersion { HTTP_10 = 1, HTTP_11 };
-
-class MimeType {
-private:
-    static void init();
-    static std::unordered_map<std::string, std::string> mime;
-    MimeType();
-    MimeType(const MimeType &m);
-
+// 连接只在所属的IO线程中创建, 引用和析构, 引用计数不需要原子操作:
+// poller(注册期间), 定时器节点(未到期时)和正在执行的事件或回调各持有一个引用
+class HttpData : public RefCounted<HttpData> {
 public:
-    static std::string getMime(const std::string &suffix);
-
-private:
-    static pthread_once_t once_control;
-};
-
-class HttpData : public std::enable_shared_from_this<HttpData> {
-public:
-    HttpData(EventLoop *loop, int connfd);
-    ~HttpData() { close(fd_); }
+    // router和options在所有连接间共享, 只读; peerAddr为对端的IPv4地址(网络字节序), 用于限流
+    HttpData(EventLoop *loop, int connfd, uint32_t peerAddr, const Router *router,
+             const HttpOptions *options);
+    ~HttpData();
+    // 由accept的线程投递到loop中执行: 在IO线程中创建连接并注册到poller
+    static void create(EventLoop *loop, int connfd, uint32_t peerAddr, const Router *router,
+                       const HttpOptions *options);
+    // 只在所属的IO线程中创建和析构, 从该线程的slab分配
+    static void *operator new(size_t size);
+    static void operator delete(void *p);
     void reset();
     void seperateTimer();
-    void linkTimer(std::shared_ptr<TimerNode> mtimer) {
-        // shared_ptr重载了bool, 但weak_ptr没有
+    void linkTimer(TimerNode *mtimer) {
+        seperateTimer();
         timer_ = mtimer;
     }
-    std::shared_ptr<Channel> getChannel() { return channel_; }
+    uint64_t id() const { return id_; }
+    ConnectionHandle handle() const {
+        ConnectionHandle h = {loop_, fd_, id_};
+        return h;
+    }
+    // 所有线程中还没有析构的连接数
+    static int connectionCount() { return connections_.load(std::memory_order_relaxed); }
     EventLoop *getLoop() { return loop_; }
     void handleClose();
+    // 定时器到期时调用
+    void handleTimeout();
     void newEvent();
 
 private:
+    friend class Channel;
+    friend class HttpResponse;
+    friend class BodySink;
+    friend class ResponseWriter;
+
+    static std::atomic<int> connections_;
+
+    // 按访问频率排列: 每次事件都要访问的状态和缓冲区在前面, 其次是Channel(回调)和每轮事件
+    // 结束时比较一次的指标, 只在处理请求时才用到的解析结果, 路由参数等在最后. 对象从所属线程的
+    // slab中按缓存行对齐分配(见operator new), 同一线程的连接也集中在连续的内存中.
+    // x86-64/libstdc++上channel_位于168字节处(状态96字节加inBuffer_和outBuffer_), 放不进
+    // 前两个缓存行; 到reportedMemory_为止的240字节在前四个缓存行内, 见构造函数中的static_assert
     EventLoop *loop_;
-    std::shared_ptr<Channel> channel_;
+    const HttpOptions *options_;
     int fd_;
-    std::string inBuffer_;
-    std::string outBuffer_;
-    bool error_;
     ConnectionState connectionState_;
-
+    ProcessState state_;
+    int pendingResponses_;
+    bool error_;
+    bool keepAlive_;
+    bool bodyPaused_;
+    // 用完了本次事件的读取额度, 在事件循环的就绪队列中等待继续读
+    bool readDeferred_;
+    // 等待FileLoader, 期间不处理后面的请求, 也不从socket读
+    bool fileWait_;
+    bool flushQueued_;
+    // HTTP/1.0的流式响应以关闭连接结束
+    bool shutdownAfterFlush_;
+    // 待发送的数据超过高水位, 停止解析和读取, 降到低水位以下时恢复
+    bool pipelinePaused_;
+    // 定时器到期时计入的指标
+    MetricId timeoutReason_;
+    // 当前请求在inBuffer_中的起始位置, 已处理完的请求在一次读事件结束时统一删除
+    size_t nowReadPos_;
+    // inBuffer_中紧跟头部的body长度; 流式和chunked的body边解码边删除, 为0
+    size_t bodyLength_;
+    // 未到期的定时器节点, 节点持有本连接的引用, 解除关联或到期时置为NULL
+    TimerNode *timer_;
+    // 各阶段的开始时间(monotonicMicros), 截止时间见nextTimeout和HttpOptions;
+    // requestStart_为0表示还没有收到下一个请求的数据
+    int64_t requestStart_;
+    int64_t idleStart_;
+    std::string inBuffer_;
+    OutputQueue outBuffer_;
+
+    Channel channel_;
+
+    // 上次计入Metrics的缓冲区大小和内存占用
+    size_t reportedInput_;
+    size_t reportedOutput_;
+    size_t reportedMemory_;
+
+    // 以下只在处理请求时访问
+    // 正在进行的流式响应, 结束前不处理后面的请求
+    std::shared_ptr<ResponseWriter> stream_;
+    // 流式路由正在接收body, 收完后由它发送响应
+    std::shared_ptr<BodySink> sink_;
+    const Router *router_;
+    uint64_t id_;
+    uint32_t peerAddr_;
     HttpMethod method_;
     HttpVersion HTTPVersion_;
+    int64_t bodyStart_;
+    int64_t bodyPausedAt_;
+    HttpRequestParser request_;
+    RouteMatch match_;
+    BodyDecoder bodyDecoder_;
+    // 普通路由chunked编码的body解码后放在这里
+    std::string body_;
     std::string fileName_;
-    std::string path_;
-    int nowReadPos_;
-    ProcessState state_;
-    ParseState hState_;
-    bool keepAlive_;
-    std::map<std::string, std::string> headers_;
-    void* src_addr_;
-    size_t src_size_;
-    size_t src_transferred_;
-    std::weak_ptr<TimerNode> timer_;
 
     void handleRead();
     void handleWrite();
     void handleConn();
+    void handleReset();
+    void processPipeline();
+    bool pipelineFull() const;
+    bool pipelineDrained() const;
+    void highWaterMark();
+    void lowWaterMark();
+    void updateMetrics();
+    bool idle() const;
+    void compact();
+    size_t memoryUsage() const;
+    int nextTimeout();
+    uint64_t bodyReceived() const;
+    bool handleRequest();
+    bool finishRequest(AnalysisState flag);
+    bool beginRequest();
+    void headerTooLarge(bool uri);
+    bool receiveBody();
+    bool directBody() const;
+    void resumeBody();
+    void resumeProcessing();
+    void deferRead();
+    void readReady();
+    void scheduleFlush();
+    void flushQueued();
+    void endStream(bool shutdown);
+    void abortStream();
+    void flushOutput();
     void handleError(int fd, int err_num, std::string short_msg);
-    URIState parseURI();
-    HeaderState parseHeaders();
     AnalysisState analysisRequest();
+    AnalysisState finishStream();
+    AnalysisState serveFile(std::string_view path);
+    AnalysisState serveCachedFile();
+    void loadFile(FileLoader *loader);
+    void fileLoaded();
+    AnalysisState serveAsset(const Asset &asset);
+    void writeCommonHeaders(HeaderWriter &header, std::string_view status);
+    void writeCommonHeaders(HeaderWriter &header, int status, std::string_view reason);
+    void writeKeepAliveHeaders(HeaderWriter &header);
+    bool notModified(const FileInfo &info);
+    bool rangeApplies(const FileInfo &info);
 };
\ No newline at end of file
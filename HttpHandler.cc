@@ -0,0 +1,222 @@
+#include "HttpHandler.h"
+#include <assert.h>
+#include <stdio.h>
+#include "EventLoop.h"
+#include "HttpData.h"
+#include "HttpOptions.h"
+#include "Metrics.h"
+#include "ResponseHeader.h"
+
+using namespace std;
+
+string_view HttpRequest::queryParam(string_view name) const {
+    string_view query = parser_.query();
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t end = query.find('&', pos);
+        if (end == string_view::npos) end = query.size();
+        string_view pair = query.substr(pos, end - pos);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == name)
+            return eq == string_view::npos ? pair.substr(pair.size()) : pair.substr(eq + 1);
+        pos = end + 1;
+    }
+    return string_view();
+}
+
+string_view HttpRequest::param(string_view name) const {
+    for (int i = 0; i < match_.paramCount; ++i)
+        if ((*match_.paramNames)[i] == name) return match_.params[i];
+    return string_view();
+}
+
+void HttpResponse::sendResponse(int status, string_view reason, string_view contentType,
+                                string_view body, bool copy) {
+    assert(!sent_);
+    if (sent_) return;
+    sent_ = true;
+    HeaderWriter header;
+    conn_->writeCommonHeaders(header, status, reason);
+    if (!contentType.empty()) header << "Content-Type: " << contentType << "\r\n";
+    header << "Content-Length: " << body.size() << "\r\n\r\n";
+    if (header.overflowed()) {
+        failed_ = true;
+        conn_->handleError(conn_->fd_, 500, "Internal Server Error");
+        return;
+    }
+    conn_->outBuffer_.append(header.data(), header.size());
+    if (conn_->method_ == METHOD_HEAD || body.empty()) return;
+    if (copy)
+        conn_->outBuffer_.append(body.data(), body.size());
+    else
+        conn_->outBuffer_.appendStatic(body.data(), body.size());
+}
+
+void HttpResponse::send(int status, string_view reason, string_view contentType,
+                        string_view body) {
+    sendResponse(status, reason, contentType, body, true);
+}
+
+void HttpResponse::sendStatic(int status, string_view reason, string_view contentType,
+                              string_view body) {
+    sendResponse(status, reason, contentType, body, false);
+}
+
+void HttpResponse::sendError(int status, string_view reason) {
+    assert(!sent_);
+    if (sent_) return;
+    sent_ = failed_ = true;
+    conn_->handleError(conn_->fd_, status, string(reason));
+}
+
+void HttpResponse::sendFile(string_view path) {
+    assert(!sent_);
+    if (sent_) return;
+    sent_ = true;
+    failed_ = conn_->serveFile(path) != ANALYSIS_SUCCESS;
+}
+
+shared_ptr<ResponseWriter> HttpResponse::sendStream(int status, string_view reason,
+                                                   string_view contentType) {
+    assert(!sent_);
+    if (sent_) return NULL;
+    sent_ = true;
+    // HTTP/1.0没有chunked, 以关闭连接表示body结束
+    bool chunked = conn_->HTTPVersion_ == HTTP_11;
+    if (!chunked) conn_->keepAlive_ = false;
+    HeaderWriter header;
+    conn_->writeCommonHeaders(header, status, reason);
+    if (!contentType.empty()) header << "Content-Type: " << contentType << "\r\n";
+    if (chunked)
+        header << "Transfer-Encoding: chunked\r\n\r\n";
+    else
+        header << kCloseHeader << "\r\n";
+    if (header.overflowed()) {
+        // 返回一个已经关闭的writer, 调用者的write都返回false
+        failed_ = true;
+        conn_->handleError(conn_->fd_, 500, "Internal Server Error");
+        shared_ptr<ResponseWriter> writer(new ResponseWriter(conn_, chunked, true));
+        writer->closed_ = true;
+        return writer;
+    }
+    conn_->outBuffer_.append(header.data(), header.size());
+    shared_ptr<ResponseWriter> writer(
+        new ResponseWriter(conn_, chunked, conn_->method_ == METHOD_HEAD));
+    conn_->stream_ = writer;
+    return writer;
+}
+
+shared_ptr<ResponseWriter> HttpResponse::defer() {
+    assert(!sent_);
+    if (sent_) return NULL;
+    sent_ = true;
+    shared_ptr<ResponseWriter> writer(new ResponseWriter(conn_, false, false));
+    writer->deferred_ = true;
+    conn_->stream_ = writer;
+    return writer;
+}
+
+ResponseWriter::ResponseWriter(HttpData *conn, bool chunked, bool discard)
+    : conn_(conn->handle()),
+      loop_(conn->loop_),
+      chunked_(chunked),
+      discard_(discard),
+      ended_(false),
+      closed_(false),
+      blocked_(false),
+      deferred_(false) {}
+
+bool ResponseWriter::write(string_view data) {
+    assert(!ended_ && !deferred_);
+    if (closed_ || ended_) return false;
+    loop_->assertInLoopThread();
+    HttpData *conn = conn_.get();
+    if (!conn || conn->error_ || conn->connectionState_ == H_DISCONNECTED) {
+        closed_ = true;
+        return false;
+    }
+    if (!discard_ && !data.empty()) {
+        if (chunked_) {
+            char head[24];
+            int n = snprintf(head, sizeof head, "%zx\r\n", data.size());
+            conn->outBuffer_.append(head, n);
+            conn->outBuffer_.append(data.data(), data.size());
+            conn->outBuffer_.append("\r\n", 2);
+        } else {
+            conn->outBuffer_.append(data.data(), data.size());
+        }
+        conn->scheduleFlush();
+    }
+    blocked_ = conn->outBuffer_.bytes() >= conn->options_->outputHighWaterMark;
+    return !blocked_;
+}
+
+void ResponseWriter::end() {
+    assert(!deferred_);
+    if (ended_) return;
+    ended_ = true;
+    drain_ = nullptr;
+    if (closed_) return;
+    loop_->assertInLoopThread();
+    HttpData *conn = conn_.get();
+    if (!conn) return;
+    if (chunked_ && !discard_) conn->outBuffer_.appendStatic("0\r\n\r\n", 5);
+    conn->endStream(!chunked_);
+}
+
+void ResponseWriter::send(int status, string_view reason, string_view contentType,
+                          string_view body) {
+    assert(deferred_ && !ended_);
+    if (ended_) return;
+    ended_ = true;
+    drain_ = nullptr;
+    if (closed_) return;
+    loop_->assertInLoopThread();
+    HttpData *conn = conn_.get();
+    if (!conn || conn->error_ || conn->connectionState_ == H_DISCONNECTED) return;
+    HttpResponse resp(conn);
+    resp.send(status, reason, contentType, body);
+    if (resp.failed())
+        conn->abortStream();
+    else
+        conn->endStream(false);
+}
+
+void ResponseWriter::sendError(int status, string_view reason) {
+    assert(deferred_ && !ended_);
+    if (ended_) return;
+    ended_ = true;
+    drain_ = nullptr;
+    if (closed_) return;
+    loop_->assertInLoopThread();
+    HttpData *conn = conn_.get();
+    if (!conn || conn->error_ || conn->connectionState_ == H_DISCONNECTED) return;
+    conn->handleError(conn->fd_, status, string(reason));
+    conn->abortStream();
+}
+
+void ResponseWriter::notify() {
+    blocked_ = false;
+    // 回调中可能调用end()清除drain_
+    function<void()> cb(drain_);
+    if (cb) cb();
+}
+
+void BodySink::resume() {
+    ConnectionHandle conn(conn_);
+    // StreamHandler返回之前还没有关联到连接, 也不可能已经暂停
+    if (conn.loop == NULL) return;
+    conn.loop->queueInLoop([conn] {
+        Ref<HttpData> guard(conn.get());
+        if (guard) guard->resumeBody();
+    });
+}
+
+void staticFileHandler(const HttpRequest &req, HttpResponse &resp) {
+    string_view path = req.param("*");
+    resp.sendFile(path.empty() ? "index.html" : path);
+}
+
+void metricsHandler(const HttpRequest &, HttpResponse &resp) {
+    resp.send(200, "OK", "text/plain; version=0.0.4", formatMetrics());
+}
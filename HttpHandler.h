@@ -0,0 +1,165 @@
+#pragma once
+#include <errno.h>
+#include <sys/types.h>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include "ConnectionHandle.h"
+#include "HttpHeaders.h"
+#include "HttpParser.h"
+#include "Router.h"
+#include "noncopyable.h"
+
+class HttpData;
+class EventLoop;
+class ResponseWriter;
+
+// 交给handler的请求, 所有string_view都指向连接的输入缓冲区, 只在handler调用期间有效
+// 路径和查询参数都是原始形式, 不做%解码
+class HttpRequest : noncopyable {
+public:
+    HttpRequest(const HttpRequestParser &parser, const RouteMatch &match, std::string_view body)
+        : parser_(parser), match_(match), body_(body) {}
+
+    HttpMethod method() const { return parser_.method(); }
+    HttpVersion version() const { return parser_.version(); }
+    // 以'/'开头, 不含查询串
+    std::string_view path() const {
+        return std::string_view(parser_.target().data(), parser_.path().size() + 1);
+    }
+    std::string_view query() const { return parser_.query(); }
+    // 查询串中第一个名为name的参数, 不存在时返回的data()为NULL
+    std::string_view queryParam(std::string_view name) const;
+    // 路由模式中":name"匹配到的段, 结尾通配部分的名字为"*"
+    std::string_view param(std::string_view name) const;
+    std::string_view header(HeaderId id) const { return parser_.header(id); }
+    std::string_view header(std::string_view name) const { return parser_.header(name); }
+    std::string_view body() const { return body_; }
+
+private:
+    const HttpRequestParser &parser_;
+    const RouteMatch &match_;
+    std::string_view body_;
+};
+
+// handler通过HttpResponse把一个响应追加到连接的输出队列, 每个请求只能发送一次
+// Date, Server和长连接相关的头部自动添加; HEAD请求自动省略body
+class HttpResponse : noncopyable {
+public:
+    explicit HttpResponse(HttpData *conn) : conn_(conn), sent_(false), failed_(false) {}
+
+    // body会被拷贝; contentType为空时不发送Content-Type
+    void send(int status, std::string_view reason, std::string_view contentType,
+              std::string_view body);
+    // body必须在程序运行期间一直有效(如字符串常量), 不拷贝
+    void sendStatic(int status, std::string_view reason, std::string_view contentType,
+                    std::string_view body);
+    // 错误页面, 发送后关闭连接
+    void sendError(int status, std::string_view reason);
+    // 编译进程序的资源或网站目录下的文件, 支持条件请求和Range
+    void sendFile(std::string_view path);
+    // 只发送头部, body之后通过返回的ResponseWriter分段写出
+    // HTTP/1.1使用chunked编码, HTTP/1.0不带长度, 写完后关闭连接
+    std::shared_ptr<ResponseWriter> sendStream(int status, std::string_view reason,
+                                               std::string_view contentType);
+    // 稍后再发送完整的响应(如把可能阻塞的磁盘操作交给后台线程), 在IO线程中调用返回的
+    // ResponseWriter的send或sendError; 发送之前后面流水线上的请求不会被处理
+    std::shared_ptr<ResponseWriter> defer();
+
+    bool sent() const { return sent_; }
+    bool failed() const { return failed_; }
+
+private:
+    void sendResponse(int status, std::string_view reason, std::string_view contentType,
+                      std::string_view body, bool copy);
+
+    HttpData *conn_;
+    bool sent_;
+    bool failed_;
+};
+
+// 流式响应的body, 只能在连接所属的IO线程中使用, 其他线程通过loop()->runInLoop转过来
+// 连接上待发送的数据超过HttpOptions::outputHighWaterMark时write返回false, 生产者应当暂停,
+// 降到outputLowWaterMark以下时调用drain回调; 响应结束前后面流水线上的请求不会被处理
+class ResponseWriter : noncopyable {
+public:
+    // 追加一段body, 数据会被拷贝; 返回false表示超过了高水位或连接已经关闭
+    bool write(std::string_view data);
+    // 结束响应, 之后不能再write
+    void end();
+    // 只用于HttpResponse::defer返回的writer: 发送完整的响应(sendError之后关闭连接),
+    // 只能调用一次, 不能再write/end; 连接已经关闭时什么也不做
+    void send(int status, std::string_view reason, std::string_view contentType,
+              std::string_view body);
+    void sendError(int status, std::string_view reason);
+    // 在IO线程中调用: 暂停之后降到低水位以下, 或者连接关闭(此时closed()为true)
+    // end()或连接关闭后回调被清除, 因此回调中持有writer不会造成循环引用
+    void setDrainCallback(std::function<void()> cb) { drain_ = std::move(cb); }
+    bool closed() const { return closed_; }
+    bool ended() const { return ended_; }
+    EventLoop *loop() const { return loop_; }
+
+private:
+    friend class HttpResponse;
+    friend class HttpData;
+    ResponseWriter(HttpData *conn, bool chunked, bool discard);
+    void notify();
+
+    ConnectionHandle conn_;
+    EventLoop *loop_;
+    bool chunked_;
+    bool discard_;  // HEAD请求不发送body
+    bool ended_;
+    bool closed_;
+    bool blocked_;  // 上次write超过了高水位, 等待drain
+    bool deferred_;  // 由defer()创建, 还没有发送任何数据
+    std::function<void()> drain_;
+};
+
+// 流式路由接收body的接口, 由StreamHandler在头部解析完后创建, 回调都在连接的IO线程中
+// body按到达的顺序分段交给onData, chunked编码已经解开; 连接上缓存的未消费数据
+// 不超过HttpOptions::readChunkSize, 消费不过来时停止读取socket, 由TCP把压力传给客户端
+// StreamHandler收到的HttpRequest只在调用期间有效, 需要的参数应在创建BodySink时拷贝
+class BodySink : noncopyable {
+public:
+    BodySink() : conn_(), rejectStatus_(0) {}
+    virtual ~BodySink() {}
+
+    // 返回用掉的字节数, 少于data.size()时暂停, 剩下的数据在resume()之后重新投递
+    virtual size_t onData(std::string_view data) = 0;
+    // body接收完毕, 必须通过resp发送响应
+    virtual void onEnd(HttpResponse &resp) = 0;
+    // body接收完之前连接出错或关闭
+    virtual void onAbort() {}
+
+    // 可选: 定长的body不经过连接的输入缓冲区, 由BodySink直接从socket取走(如splice到文件)
+    // 已经缓存的部分仍然先交给onData; maxBytes不超过body剩余的长度
+    // 返回值同read(2): 取走的字节数, 0表示对端关闭, -1且errno为EAGAIN表示暂时没有数据
+    virtual bool canReadFrom() const { return false; }
+    virtual ssize_t readFrom(int fd, size_t maxBytes) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    // 暂停后继续接收, 可以在任意线程调用; 连接已经关闭, 或在StreamHandler返回之前调用时什么也不做
+    void resume();
+
+protected:
+    // 在onData中调用: 不再接收剩下的body, 回复错误页面(如超过配额时的413)后关闭连接,
+    // 之后调用onAbort而不是onEnd
+    void reject(int status, std::string_view reason) {
+        rejectStatus_ = status;
+        rejectReason_ = reason;
+    }
+
+private:
+    friend class HttpData;
+    ConnectionHandle conn_;
+    int rejectStatus_;
+    std::string rejectReason_;
+};
+
+// 静态文件: 路由的通配部分作为相对路径, 为空时使用index.html
+void staticFileHandler(const HttpRequest &req, HttpResponse &resp);
+// 导出Metrics.h中的指标
+void metricsHandler(const HttpRequest &req, HttpResponse &resp);
@@ -0,0 +1,98 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+
+// 常用请求头, 解析时直接按HeaderId放进定长数组, 其余头部放到一个小vector里
+enum HeaderId {
+    HDR_CONNECTION = 0,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_EXPECT,
+    HDR_HOST,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_COOKIE,
+    HDR_REFERER,
+    HDR_CACHE_CONTROL,
+    HDR_AUTHORIZATION,
+    HDR_ORIGIN,
+    HDR_UPGRADE,
+    HDR_KNOWN_COUNT,
+    HDR_UNKNOWN = HDR_KNOWN_COUNT
+};
+
+inline constexpr std::string_view kHeaderNames[HDR_KNOWN_COUNT] = {
+    "Connection",      "Content-Length",    "Content-Type",  "Transfer-Encoding",
+    "Expect",          "Host",              "Range",         "If-Range",
+    "If-None-Match",   "If-Modified-Since", "Accept",        "Accept-Encoding",
+    "Accept-Language", "User-Agent",        "Cookie",        "Referer",
+    "Cache-Control",   "Authorization",     "Origin",        "Upgrade",
+};
+
+// 名字到HeaderId的完美哈希: 长度和首/中/尾三个字符(转小写)拼成key, 乘seed后取高位
+// seed在编译期搜索, 保证上面的名字落在不同的槽里
+const int kHeaderHashBits = 6;
+const int kHeaderHashSize = 1 << kHeaderHashBits;
+
+constexpr unsigned char headerLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + 32)
+                                  : static_cast<unsigned char>(c);
+}
+
+constexpr unsigned headerHash(std::string_view s, uint32_t seed) {
+    uint32_t key = static_cast<uint32_t>(s.size()) | headerLower(s[0]) << 8 |
+                   headerLower(s[s.size() / 2]) << 16 |
+                   static_cast<uint32_t>(headerLower(s[s.size() - 1])) << 24;
+    return (key * seed) >> (32 - kHeaderHashBits);
+}
+
+constexpr bool headerSeedIsPerfect(uint32_t seed) {
+    bool used[kHeaderHashSize] = {};
+    for (int i = 0; i < HDR_KNOWN_COUNT; ++i) {
+        unsigned h = headerHash(kHeaderNames[i], seed);
+        if (used[h]) return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t findHeaderSeed() {
+    for (uint32_t seed = 0x9e3779b1u; seed < 0x9e3779b1u + 200000; seed += 2)
+        if (headerSeedIsPerfect(seed)) return seed;
+    return 0;
+}
+
+inline constexpr uint32_t kHeaderSeed = findHeaderSeed();
+static_assert(kHeaderSeed != 0, "no perfect hash seed for the known header names");
+
+struct HeaderSlots {
+    int8_t slot[kHeaderHashSize];
+};
+
+constexpr HeaderSlots buildHeaderSlots() {
+    HeaderSlots t = {};
+    for (int i = 0; i < kHeaderHashSize; ++i) t.slot[i] = -1;
+    for (int i = 0; i < HDR_KNOWN_COUNT; ++i)
+        t.slot[headerHash(kHeaderNames[i], kHeaderSeed)] = static_cast<int8_t>(i);
+    return t;
+}
+
+inline constexpr HeaderSlots kHeaderSlots = buildHeaderSlots();
+
+// 大小写不敏感, 不是常用头部时返回HDR_UNKNOWN
+inline HeaderId headerIdOf(std::string_view name) {
+    if (name.empty()) return HDR_UNKNOWN;
+    int id = kHeaderSlots.slot[headerHash(name, kHeaderSeed)];
+    if (id < 0 || kHeaderNames[id].size() != name.size()) return HDR_UNKNOWN;
+    const char *known = kHeaderNames[id].data();
+    for (size_t i = 0; i < name.size(); ++i)
+        if (headerLower(known[i]) != headerLower(name[i])) return HDR_UNKNOWN;
+    return static_cast<HeaderId>(id);
+}
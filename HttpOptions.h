@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+
+// 所有连接共享的HTTP参数, 在Server::start之前设置, 之后只读
+struct HttpOptions {
+    // 普通路由的body整体缓存在内存中交给handler, 超过时返回413
+    size_t maxBodySize = 1024 * 1024;
+    // 请求行和头部的总长度上限, 超过时返回431(请求行本身超过时返回414)
+    size_t maxHeaderSize = 16 * 1024;
+    // 各阶段的截止时间(毫秒), 从阶段开始计算, 收到部分数据不会延长:
+    // 请求行和头部都从请求的第一个字节(新连接从accept)开始计时;
+    // body从头部解析完开始, 给出bodyTimeoutMs之后还要求平均速率不低于minBodyRate(字节/秒,
+    // 为0时bodyTimeoutMs就是整个body的期限), BodySink暂停期间不计时;
+    // keepAliveTimeoutMs为两个请求之间的空闲时间, 也写在Keep-Alive头部中;
+    // responseTimeoutMs是等待对端接收响应(或流式响应的数据)时两次进展之间的最长时间
+    int requestLineTimeoutMs = 10 * 1000;
+    int headerTimeoutMs = 20 * 1000;
+    int bodyTimeoutMs = 10 * 1000;
+    size_t minBodyRate = 1024;
+    int keepAliveTimeoutMs = 5 * 60 * 1000;
+    int responseTimeoutMs = 60 * 1000;
+    // 每次从socket读取的上限, 处理完再继续读;
+    // 流式路由每个连接缓存的body不超过这个大小, BodySink消费不过来时停止读取
+    size_t readChunkSize = 64 * 1024;
+    // 每个连接一次事件最多读取的字节数(至少读一次), 用完时还有数据的连接
+    // 排到事件循环的就绪队列末尾, 一个大的上传不会让同一线程的其它连接等待
+    size_t readBudget = 256 * 1024;
+    // 连接上待发送数据的高低水位: 流式响应超过高水位时ResponseWriter::write返回false,
+    // 降到低水位以下时回调
+    size_t outputHighWaterMark = 256 * 1024;
+    size_t outputLowWaterMark = 64 * 1024;
+    // 每个IO线程每轮执行queueInLoop回调的时间额度(微秒)
+    int loopFunctorBudgetUs = 1000;
+    // 过载保护: 连接数达到maxConnections, 或某个IO线程每轮循环的平均耗时超过overloadLatencyUs时
+    // 停止accept, 新连接留在内核的监听队列中; 连接数降到90%以下且耗时降到一半以下才恢复. 0表示不检查
+    int maxConnections = 50000;
+    int overloadLatencyUs = 50000;
+    // 大于0时过载期间照常accept, 回复预先生成的503(Retry-After为这个秒数)后立即关闭
+    int overloadRetryAfter = 0;
+    // 按客户端IP的令牌桶限流, 速率(每秒)为0表示不限制, 超过时回复429并关闭连接.
+    // 新连接在accept线程检查, 请求在各IO线程分别检查(同一IP的连接分布在多个线程时,
+    // 总的请求速率最多为线程数倍); 每个线程最多记录rateLimitClients个IP, 超过时淘汰最久没有出现的
+    int connectionsPerSec = 0;
+    int connectionBurst = 20;
+    int requestsPerSec = 0;
+    int requestBurst = 100;
+    size_t rateLimitClients = 16 * 1024;
+    // 静态文件第一次访问(不在本线程的FileCache中)时, stat和预读文件开头fileIoPrefetchBytes字节
+    // 交给fileIoThreads个后台线程完成, 期间连接暂停处理后面的请求; 为0时在IO线程中直接stat.
+    // 单线程配置(ServerPolicy::kMultiThread为false)中不使用
+    int fileIoThreads = 2;
+    size_t fileIoPrefetchBytes = 1024 * 1024;
+};
@@ -0,0 +1,208 @@
+#include "HttpParser.h"
+#include <string.h>
+#include <strings.h>
+#include "SimdScan.h"
+
+void HttpRequestParser::reset() {
+    base_ = NULL;
+    state_ = S_REQUEST_LINE;
+    lineBegin_ = 0;
+    scanned_ = 0;
+    headerLength_ = 0;
+    method_ = METHOD_GET;
+    version_ = HTTP_11;
+    target_ = path_ = query_ = span(0, 0);
+    headerCount_ = 0;
+    memset(known_, 0, sizeof known_);
+    others_.clear();
+}
+
+HttpRequestParser::Result HttpRequestParser::parse(const char *data, size_t len) {
+    base_ = data;
+    while (state_ != S_DONE) {
+        // 只在新到达的数据中找行尾
+        const char *lf = scanFindChar(data + scanned_, data + len, '\n');
+        if (lf == data + len) {
+            scanned_ = len;
+            return PARSE_AGAIN;
+        }
+        size_t lfPos = lf - data;
+        size_t end = lfPos;
+        if (end > lineBegin_ && data[end - 1] == '\r') --end;
+        bool ok = state_ == S_REQUEST_LINE ? parseRequestLine(lineBegin_, end)
+                                           : parseHeaderLine(lineBegin_, end);
+        if (!ok) return PARSE_ERROR;
+        lineBegin_ = scanned_ = lfPos + 1;
+        if (state_ == S_DONE) headerLength_ = lineBegin_;
+    }
+    return PARSE_DONE;
+}
+
+bool HttpRequestParser::parseRequestLine(size_t begin, size_t end) {
+    const char *p = base_ + begin;
+    const char *last = base_ + end;
+    // 忽略请求之间多余的空行
+    if (p == last) return true;
+
+    // Method, 只看第一个token
+    const char *sp = scanSkipToken(p, last);
+    if (sp == last || *sp != ' ') return false;
+    size_t n = sp - p;
+    if (n == 3 && memcmp(p, "GET", 3) == 0)
+        method_ = METHOD_GET;
+    else if (n == 4 && memcmp(p, "POST", 4) == 0)
+        method_ = METHOD_POST;
+    else if (n == 4 && memcmp(p, "HEAD", 4) == 0)
+        method_ = METHOD_HEAD;
+    else
+        return false;
+
+    // request-target, 只接受origin-form
+    p = sp + 1;
+    sp = scanFindChar(p, last, ' ');
+    if (sp == last || sp == p || *p != '/') return false;
+    size_t targetBegin = p - base_, targetEnd = sp - base_;
+    target_ = span(targetBegin, targetEnd);
+    const char *q = scanFindChar(p, sp, '?');
+    if (q == sp) {
+        path_ = span(targetBegin + 1, targetEnd);
+        query_ = span(targetEnd, targetEnd);
+    } else {
+        path_ = span(targetBegin + 1, q - base_);
+        query_ = span(q - base_ + 1, targetEnd);
+    }
+
+    // HTTP版本号
+    p = sp + 1;
+    if (last - p != 8 || memcmp(p, "HTTP/1.", 7) != 0) return false;
+    if (p[7] == '1')
+        version_ = HTTP_11;
+    else if (p[7] == '0')
+        version_ = HTTP_10;
+    else
+        return false;
+    state_ = S_HEADERS;
+    return true;
+}
+
+bool HttpRequestParser::parseHeaderLine(size_t begin, size_t end) {
+    // 空行, 头部结束
+    if (begin == end) {
+        state_ = S_DONE;
+        return true;
+    }
+    if (static_cast<int>(headerCount_) >= kMaxHeaders) return false;
+    // 头部名必须全部是tchar, 紧跟':'
+    size_t colon = scanSkipToken(base_ + begin, base_ + end) - base_;
+    if (colon == end || colon == begin || base_[colon] != ':') return false;
+    // 去掉值两端的空白, 值中不允许出现控制字符(包括单独的CR)
+    size_t vb = colon + 1, ve = end;
+    while (vb < ve && (base_[vb] == ' ' || base_[vb] == '\t')) ++vb;
+    while (ve > vb && (base_[ve - 1] == ' ' || base_[ve - 1] == '\t')) --ve;
+    if (scanFindCtl(base_ + vb, base_ + ve) != base_ + ve) return false;
+    ++headerCount_;
+    HeaderId id = headerIdOf(std::string_view(base_ + begin, colon - begin));
+    // 决定body长度的头部重复时无法确定以哪个为准(请求走私), 值完全相同的Content-Length除外
+    if (id == HDR_TRANSFER_ENCODING && known_[id].off != 0) return false;
+    if (id == HDR_CONTENT_LENGTH && known_[id].off != 0 &&
+        view(known_[id]) != std::string_view(base_ + vb, ve - vb))
+        return false;
+    if (id != HDR_UNKNOWN && known_[id].off == 0) {
+        known_[id] = span(vb, ve);
+    } else {
+        Header h = {span(begin, colon), span(vb, ve)};
+        others_.push_back(h);
+    }
+    return true;
+}
+
+std::string_view HttpRequestParser::header(std::string_view name) const {
+    HeaderId id = headerIdOf(name);
+    if (id != HDR_UNKNOWN) return header(id);
+    for (const Header &h : others_) {
+        if (h.name.len == name.size() &&
+            strncasecmp(base_ + h.name.off, name.data(), name.size()) == 0)
+            return view(h.value);
+    }
+    return std::string_view();
+}
+
+void BodyDecoder::reset(bool chunked, uint64_t contentLength) {
+    chunked_ = chunked;
+    state_ = chunked ? B_SIZE : (contentLength > 0 ? B_DATA : B_DONE);
+    remaining_ = chunked ? 0 : contentLength;
+    received_ = 0;
+    trailerLength_ = 0;
+}
+
+BodyDecoder::Result BodyDecoder::next(const char *data, size_t len, size_t *skipped,
+                                      std::string_view *chunk) {
+    size_t pos = 0;
+    Result result = BODY_AGAIN;
+    while (result == BODY_AGAIN) {
+        if (state_ == B_DATA) {
+            if (pos == len) break;
+            size_t n = len - pos < remaining_ ? len - pos : static_cast<size_t>(remaining_);
+            *chunk = std::string_view(data + pos, n);
+            result = BODY_DATA;
+        } else if (state_ == B_DATA_END) {
+            // 每个chunk的数据后面必须紧跟CRLF
+            if (len - pos < 2) break;
+            if (data[pos] != '\r' || data[pos + 1] != '\n') return BODY_ERROR;
+            pos += 2;
+            state_ = B_SIZE;
+        } else if (state_ == B_DONE) {
+            result = BODY_DONE;
+        } else {
+            const char *lf = scanFindChar(data + pos, data + len, '\n');
+            size_t limit = state_ == B_SIZE ? kMaxLineLength : kMaxTrailerLength - trailerLength_;
+            if (lf == data + len) {
+                if (len - pos > limit) return BODY_ERROR;
+                break;
+            }
+            size_t lineLength = lf + 1 - (data + pos);
+            if (lineLength > limit || lineLength < 2 || lf[-1] != '\r') return BODY_ERROR;
+            if (state_ == B_SIZE) {
+                if (!parseSizeLine(data + pos, lf - 1)) return BODY_ERROR;
+            } else if (lineLength == 2) {
+                // trailer以空行结束, 其中的字段直接忽略
+                state_ = B_DONE;
+            } else {
+                trailerLength_ += lineLength;
+            }
+            pos += lineLength;
+        }
+    }
+    *skipped = pos;
+    return result;
+}
+
+// chunk-size [; ext] CRLF, 大小为0时进入trailer
+bool BodyDecoder::parseSizeLine(const char *p, const char *end) {
+    uint64_t size = 0;
+    const char *digits = p;
+    for (; p != end; ++p) {
+        int d;
+        if (*p >= '0' && *p <= '9')
+            d = *p - '0';
+        else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+            d = (*p | 0x20) - 'a' + 10;
+        else
+            break;
+        if (size > (UINT64_MAX >> 4)) return false;
+        size = (size << 4) | d;
+    }
+    if (p == digits) return false;
+    while (p != end && (*p == ' ' || *p == '\t')) ++p;
+    if (p != end && *p != ';') return false;
+    if (scanFindCtl(p, end) != end) return false;
+    remaining_ = size;
+    state_ = size > 0 ? B_DATA : B_TRAILER;
+    return true;
+}
+
+void BodyDecoder::consume(size_t n) {
+    remaining_ -= n;
+    received_ += n;
+    if (remaining_ == 0) state_ = chunked_ ? B_DATA_END : B_DONE;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+#include "HttpHeaders.h"
+
+enum HttpMethod { METHOD_POST = 1, METHOD_GET, METHOD_HEAD };
+
+enum HttpVersion { HTTP_10 = 1, HTTP_11 };
+
+// 增量解析请求行和头部, 不拷贝任何数据
+// 解析结果以相对请求起始位置的偏移保存, 缓冲区在两次parse之间可以扩容或整体移动,
+// 只要请求的起始位置对应的内容不变; 数据不完整时记住扫描位置, 下次不重复扫描
+class HttpRequestParser {
+public:
+    enum Result { PARSE_AGAIN = 1, PARSE_DONE, PARSE_ERROR };
+    static const int kMaxHeaders = 100;
+
+    HttpRequestParser() { reset(); }
+    void reset();
+    // 释放保存不常用头部的数组, 连接进入空闲时调用(需要先reset)
+    void shrink() { std::vector<Header>().swap(others_); }
+    size_t memoryUsage() const { return others_.capacity() * sizeof(Header); }
+
+    // data指向请求的第一个字节, len为目前收到的长度
+    Result parse(const char *data, size_t len);
+
+    // 以下接口在parse返回PARSE_DONE后使用,
+    // 返回的string_view指向最近一次parse传入的缓冲区, 缓冲区修改后失效
+    HttpMethod method() const { return method_; }
+    HttpVersion version() const { return version_; }
+    // 请求行已经完整(PARSE_AGAIN时用来区分还在请求行还是在头部)
+    bool requestLineDone() const { return state_ != S_REQUEST_LINE; }
+    // 请求行和头部(含结尾空行)的总长度, 即body的起始偏移
+    size_t headerLength() const { return headerLength_; }
+    std::string_view target() const { return view(target_); }
+    // 不含开头的'/'和查询串
+    std::string_view path() const { return view(path_); }
+    std::string_view query() const { return view(query_); }
+
+    size_t headerCount() const { return headerCount_; }
+    // 常用头部直接按下标取, 重复出现时返回第一个; 不存在时返回空的string_view(data()为NULL)
+    std::string_view header(HeaderId id) const {
+        return known_[id].off == 0 ? std::string_view() : view(known_[id]);
+    }
+    // 头部名大小写不敏感, 常用头部经完美哈希转成HeaderId, 其余的线性查找
+    std::string_view header(std::string_view name) const;
+
+private:
+    struct Span {
+        uint32_t off;
+        uint32_t len;
+    };
+    struct Header {
+        Span name;
+        Span value;
+    };
+    enum State { S_REQUEST_LINE, S_HEADERS, S_DONE };
+
+    bool parseRequestLine(size_t begin, size_t end);
+    bool parseHeaderLine(size_t begin, size_t end);
+    std::string_view view(Span s) const { return std::string_view(base_ + s.off, s.len); }
+    static Span span(size_t begin, size_t end) {
+        Span s = {static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin)};
+        return s;
+    }
+
+    const char *base_;
+    State state_;
+    size_t lineBegin_;  // 当前行的起始偏移
+    size_t scanned_;    // 已经扫描过的长度
+    size_t headerLength_;
+    HttpMethod method_;
+    HttpVersion version_;
+    Span target_;
+    Span path_;
+    Span query_;
+    size_t headerCount_;
+    // 值的偏移一定大于0(前面至少有请求行), off为0表示该头部不存在
+    Span known_[HDR_KNOWN_COUNT];
+    // 不常用的头部和重复出现的常用头部, reset()保留容量, 后续请求不再分配内存, 空闲时由shrink()释放
+    std::vector<Header> others_;
+};
+
+// 请求体的解码, 支持Content-Length和Transfer-Encoding: chunked, 不拷贝数据
+// 调用者保存未处理的数据, 每次从第一个未处理的字节开始交给next:
+// *skipped为开头需要丢弃的帧格式字节(chunk-size行, CRLF, trailer), 无论结果如何都要丢弃;
+// BODY_DATA时*chunk是紧跟其后的一段数据, 调用者用consume告知实际用掉了多少
+class BodyDecoder {
+public:
+    enum Result { BODY_DATA = 1, BODY_AGAIN, BODY_DONE, BODY_ERROR };
+    // chunk-size行(含扩展)和trailer的长度上限
+    static const size_t kMaxLineLength = 1024;
+    static const size_t kMaxTrailerLength = 8192;
+
+    BodyDecoder() { reset(false, 0); }
+    void reset(bool chunked, uint64_t contentLength);
+
+    Result next(const char *data, size_t len, size_t *skipped, std::string_view *chunk);
+    void consume(size_t n);
+
+    bool chunked() const { return chunked_; }
+    // 目前为止解码出的body长度
+    uint64_t received() const { return received_; }
+    // 定长body还没有收到的长度
+    uint64_t remaining() const { return chunked_ ? 0 : remaining_; }
+
+private:
+    enum State { B_DATA, B_SIZE, B_DATA_END, B_TRAILER, B_DONE };
+
+    bool parseSizeLine(const char *p, const char *end);
+
+    bool chunked_;
+    State state_;
+    uint64_t remaining_;  // 当前chunk(或整个定长body)还没有收到的数据
+    uint64_t received_;
+    size_t trailerLength_;
+};
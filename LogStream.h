@@ -1,6 +1,7 @@
 #pragma once
 #include <assert.h>
 #include <string.h>
+#include <algorithm>
 #include <string>
 #include "noncopyable.h"
 
@@ -8,6 +9,30 @@ class AsyncLogging;
 const int kSmallBuffer = 4000;
 const int kLargeBuffer = 4000 * 1000;
 
+// From muduo
+// 整数转十进制, 结尾补'\0', 返回不含'\0'的长度; buf至少要有LogStream::kMaxNumericSize字节
+template <typename T>
+size_t convert(char buf[], T value) {
+    static const char digits[] = "9876543210123456789";
+    const char* zero = digits + 9;
+    T i = value;
+    char* p = buf;
+
+    do {
+        int lsd = static_cast<int>(i % 10);
+        i /= 10;
+        *p++ = zero[lsd];
+    } while (i != 0);
+
+    if (value < 0) {
+        *p++ = '-';
+    }
+    *p = '\0';
+    std::reverse(buf, p);
+
+    return p - buf;
+}
+
 template <int SIZE>
 class FixedBuffer : noncopyable {
 public:
@@ -100,5 +125,6 @@ private:
 
     Buffer buffer_;
 
+public:
     static const int kMaxNumericSize = 32;
 };
\ No newline at end of file
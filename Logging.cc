@@ -9,13 +9,13 @@
 
 
 static pthread_once_t once_control_ = PTHREAD_ONCE_INIT;
-static AsyncLogging *AsyncLogger_;
+static ServerPolicy::LogSink *AsyncLogger_;
 
 std::string Logger::logFileName_ = "./WebServer.log";
 
 void once_init()
 {
-    AsyncLogger_ = new AsyncLogging(Logger::getLogFileName());
+    AsyncLogger_ = new ServerPolicy::LogSink(Logger::getLogFileName());
     AsyncLogger_->start(); 
 }
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <string>
 #include "LogStream.h"
+#include "Policy.h"
 
 
 class AsyncLogging;
@@ -31,4 +32,8 @@ private:
     static std::string logFileName_;
 };
 
-#define LOG Logger(__FILE__, __LINE__).stream()
\ No newline at end of file
+// ServerPolicy::kLogging为false时整条语句(包括参数的求值)被编译器去掉
+#define LOG \
+    if (!ServerPolicy::kLogging) { \
+    } else \
+        Logger(__FILE__, __LINE__).stream()
@@ -1,17 +1,23 @@
 #include <getopt.h>
 #include <string>
 #include "EventLoop.h"
+#include "FileUpload.h"
+#include "HttpHandler.h"
 #include "Server.h"
 #include "Logging.h"
+#include "MimeType.h"
 
 int main(int argc, char *argv[]) {
     int threadNum = 4;
     int port = 80;
     std::string logPath = "./WebServer.log";
+    std::string mimePath = "/etc/mime.types";
+    std::string uploadDir;
+    bool stats = false;
 
     // parse args
     int opt;
-    const char *str = "t:l:p:";
+    const char *str = "t:l:p:m:u:s";
     while ((opt = getopt(argc, argv, str)) != -1) {
         switch (opt) {
         case 't': {
@@ -30,14 +36,39 @@ int main(int argc, char *argv[]) {
             port = atoi(optarg);
             break;
         }
+        case 'm': {
+            mimePath = optarg;
+            break;
+        }
+        case 'u': {
+            uploadDir = optarg;
+            break;
+        }
+        case 's': {
+            stats = true;
+            break;
+        }
         default:
             break;
         }
     }
     Logger::setLogFileName(logPath);
+    // 在工作线程启动前补充MIME表, -m ""表示只用内置表
+    if (!mimePath.empty()) MimeType::loadFile(mimePath.c_str());
 
     EventLoop mainLoop;
     Server myHTTPServer(&mainLoop, threadNum, port);
+    // -u指定目录时接受 POST /upload/<文件名>
+    if (!uploadDir.empty()) {
+        UploadOptions upload;
+        upload.dir = uploadDir;
+        myHTTPServer.addStreamRoute(METHOD_POST, "/upload/*", makeUploadHandler(upload));
+    }
+    // 指标中有连接数和缓冲区用量等内部信息, -s时才对外提供 GET /_stats
+    if (stats) myHTTPServer.addRoute(METHOD_GET, "/_stats", metricsHandler);
+    // 其余路径都按静态文件处理
+    myHTTPServer.addRoute(METHOD_GET, "/*", staticFileHandler);
+    myHTTPServer.addRoute(METHOD_HEAD, "/*", staticFileHandler);
     myHTTPServer.start();
     mainLoop.loop();
     return 0;
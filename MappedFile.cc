@@ -0,0 +1,59 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Logging.h"
+
+MappedFile::MappedFile(int fd, off_t fileSize)
+    : fd_(fd), fileSize_(fileSize), addr_(NULL), mapOffset_(0), mapLen_(0) {
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile() {
+    unmap();
+    close(fd_);
+}
+
+void MappedFile::unmap() {
+    if (addr_) munmap(addr_, mapLen_);
+    addr_ = NULL;
+    mapOffset_ = 0;
+    mapLen_ = 0;
+}
+
+bool MappedFile::remap(off_t offset) {
+    unmap();
+    // 窗口按kWindowSize对齐, 自然也满足页对齐
+    off_t start = offset - offset % kWindowSize;
+    size_t len = kWindowSize;
+    if (static_cast<off_t>(start + len) > fileSize_) len = fileSize_ - start;
+    void *ret = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd_, start);
+    if (ret == MAP_FAILED) {
+        LOG << "mmap failed, fd = " << fd_ << ", offset = " << (long long)start;
+        return false;
+    }
+    addr_ = static_cast<char *>(ret);
+    mapOffset_ = start;
+    mapLen_ = len;
+    madvise(addr_, mapLen_, MADV_SEQUENTIAL);
+    // 提前读入下一个窗口
+    if (static_cast<off_t>(start + len) < fileSize_)
+        posix_fadvise(fd_, start + len, kWindowSize, POSIX_FADV_WILLNEED);
+    return true;
+}
+
+const char *MappedFile::data(off_t offset, size_t *avail) {
+    if (offset < 0 || offset >= fileSize_) {
+        *avail = 0;
+        return NULL;
+    }
+    if (!addr_ || offset < mapOffset_ ||
+        offset >= static_cast<off_t>(mapOffset_ + mapLen_)) {
+        if (!remap(offset)) {
+            *avail = 0;
+            return NULL;
+        }
+    }
+    *avail = mapLen_ - (offset - mapOffset_);
+    return addr_ + (offset - mapOffset_);
+}
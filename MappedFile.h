@@ -0,0 +1,34 @@
+#pragma once
+#include <sys/types.h>
+#include <cstddef>
+#include "noncopyable.h"
+
+// 按固定大小的窗口映射文件, 大文件不会整体mmap,
+// 每个下载连接占用的映射内存不超过kWindowSize
+class MappedFile : noncopyable {
+public:
+    static const size_t kWindowSize = 4 * 1024 * 1024;
+
+    // 接管fd, 析构时关闭
+    MappedFile(int fd, off_t fileSize);
+    ~MappedFile();
+
+    off_t size() const { return fileSize_; }
+    // 返回offset处已映射的连续内存, *avail为窗口内剩余可用长度, 失败返回NULL
+    const char *data(off_t offset, size_t *avail);
+    // offset是否在当前映射的窗口中, 不在时data()会解除当前窗口的映射
+    bool mapped(off_t offset) const {
+        return addr_ != NULL && offset >= mapOffset_ &&
+            offset < static_cast<off_t>(mapOffset_ + mapLen_);
+    }
+
+private:
+    bool remap(off_t offset);
+    void unmap();
+
+    int fd_;
+    off_t fileSize_;
+    char *addr_;
+    off_t mapOffset_;
+    size_t mapLen_;
+};
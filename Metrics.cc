@@ -0,0 +1,134 @@
+#include "Metrics.h"
+#include <stdio.h>
+#include <string_view>
+#include <vector>
+#include "CurrentThread.h"
+#include "MutexLock.h"
+
+using namespace std;
+
+namespace {
+
+struct MetricInfo {
+    const char *name;
+    const char *type;
+};
+
+const MetricInfo kMetricInfo[] = {
+    {"input_buffered_bytes", "gauge"},
+    {"output_buffered_bytes", "gauge"},
+    {"read_paused_connections", "gauge"},
+    {"read_pauses_total", "counter"},
+    {"read_deferrals_total", "counter"},
+    {"functor_deferrals_total", "counter"},
+    {"connections", "gauge"},
+    {"accept_paused", "gauge"},
+    {"connections_shed_total", "counter"},
+    {"evictions_total{reason=\"request_line\"}", "counter"},
+    {"evictions_total{reason=\"headers\"}", "counter"},
+    {"evictions_total{reason=\"body\"}", "counter"},
+    {"evictions_total{reason=\"idle\"}", "counter"},
+    {"evictions_total{reason=\"response\"}", "counter"},
+    {"evictions_total{reason=\"header_too_large\"}", "counter"},
+    {"rate_limited_total{kind=\"connection\"}", "counter"},
+    {"rate_limited_total{kind=\"request\"}", "counter"},
+    {"connection_memory_bytes", "gauge"},
+    {"idle_compactions_total", "counter"},
+    {"file_loads_total", "counter"},
+    {"file_loads_coalesced_total", "counter"},
+};
+static_assert(sizeof kMetricInfo / sizeof kMetricInfo[0] == M_METRIC_COUNT,
+              "kMetricInfo must match MetricId");
+
+const char *const kHistogramNames[] = {
+    "loop_iteration_seconds",
+};
+static_assert(sizeof kHistogramNames / sizeof kHistogramNames[0] == H_HISTOGRAM_COUNT,
+              "kHistogramNames must match HistogramId");
+
+// 桶的上界, 微秒和导出时的秒
+const long kBucketBounds[kHistogramBuckets] = {25,   50,    100,   250,   500,   1000,
+                                               2500, 5000, 10000, 25000, 50000, 100000};
+const char *const kBucketLabels[kHistogramBuckets + 1] = {
+    "0.000025", "0.00005", "0.0001", "0.00025", "0.0005", "0.001", "0.0025",
+    "0.005",    "0.01",    "0.025",  "0.05",    "0.1",    "+Inf"};
+
+// 线程退出时不注销, 计数仍然计入总和(gauge此时应当已经归零)
+MutexLock g_mutex;
+vector<ThreadMetrics *> g_threads;
+
+__thread ThreadMetrics *t_metrics = NULL;
+
+}  // namespace
+
+ThreadMetrics &threadMetrics() {
+    if (__builtin_expect(t_metrics == NULL, 0)) {
+        ThreadMetrics *m = new ThreadMetrics;
+        for (int i = 0; i < M_METRIC_COUNT; ++i) m->values[i].store(0);
+        for (ThreadMetrics::Histogram &h : m->histograms) {
+            for (int i = 0; i <= kHistogramBuckets; ++i) h.buckets[i].store(0);
+            h.sum.store(0);
+        }
+        m->tid = CurrentThread::tid();
+        MutexLockGuard lock(g_mutex);
+        g_threads.push_back(m);
+        t_metrics = m;
+    }
+    return *t_metrics;
+}
+
+void histogramObserve(HistogramId id, long usec) {
+    ThreadMetrics::Histogram &h = threadMetrics().histograms[id];
+    int i = 0;
+    while (i < kHistogramBuckets && usec > kBucketBounds[i]) ++i;
+    h.buckets[i].store(h.buckets[i].load(memory_order_relaxed) + 1, memory_order_relaxed);
+    h.sum.store(h.sum.load(memory_order_relaxed) + usec, memory_order_relaxed);
+}
+
+long metricValue(MetricId id) {
+    MutexLockGuard lock(g_mutex);
+    long sum = 0;
+    for (ThreadMetrics *m : g_threads) sum += m->values[id].load(memory_order_relaxed);
+    return sum;
+}
+
+string formatMetrics() {
+    string out;
+    string_view lastFamily;
+    for (int i = 0; i < M_METRIC_COUNT; ++i) {
+        const MetricInfo &info = kMetricInfo[i];
+        // 带标签的同名指标只写一次TYPE
+        string_view family(info.name);
+        family = family.substr(0, family.find('{'));
+        if (family != lastFamily) out += "# TYPE " + string(family) + " " + info.type + "\n";
+        lastFamily = family;
+        out += string(info.name) + " " + to_string(metricValue(static_cast<MetricId>(i))) + "\n";
+    }
+    MutexLockGuard lock(g_mutex);
+    char buf[128];
+    for (int i = 0; i < H_HISTOGRAM_COUNT; ++i) {
+        const char *name = kHistogramNames[i];
+        out += string("# TYPE ") + name + " histogram\n";
+        for (ThreadMetrics *m : g_threads) {
+            const ThreadMetrics::Histogram &h = m->histograms[i];
+            // 没有记录过的线程(不是IO线程)不导出
+            long count = 0;
+            for (int b = 0; b <= kHistogramBuckets; ++b)
+                count += h.buckets[b].load(memory_order_relaxed);
+            if (count == 0) continue;
+            long cumulative = 0;
+            for (int b = 0; b <= kHistogramBuckets; ++b) {
+                cumulative += h.buckets[b].load(memory_order_relaxed);
+                snprintf(buf, sizeof buf, "%s_bucket{thread=\"%d\",le=\"%s\"} %ld\n", name,
+                         m->tid, kBucketLabels[b], cumulative);
+                out += buf;
+            }
+            snprintf(buf, sizeof buf, "%s_sum{thread=\"%d\"} %.6f\n", name, m->tid,
+                     h.sum.load(memory_order_relaxed) / 1e6);
+            out += buf;
+            snprintf(buf, sizeof buf, "%s_count{thread=\"%d\"} %ld\n", name, m->tid, cumulative);
+            out += buf;
+        }
+    }
+    return out;
+}
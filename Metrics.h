@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// 服务器的运行指标, 每个线程一份, 只由所属线程修改(不需要加锁的原子操作), 导出时汇总
+// 新指标在MetricId中追加, 并在Metrics.cc的kMetricInfo中给出名字和类型
+enum MetricId {
+    // 所有连接输入缓冲区中的字节数
+    M_INPUT_BUFFERED_BYTES = 0,
+    // 所有连接待发送的字节数(含还没有发送的文件区间)
+    M_OUTPUT_BUFFERED_BYTES,
+    // 因为待发送数据超过高水位而停止读取的连接数
+    M_READ_PAUSED_CONNECTIONS,
+    // 累计停止读取的次数
+    M_READ_PAUSES,
+    // 连接用完一次事件的读取额度, 排到下一轮继续读的次数
+    M_READ_DEFERRALS,
+    // queueInLoop的回调超过一轮的时间额度, 留到下一轮执行的次数
+    M_FUNCTOR_DEFERRALS,
+    // 当前的连接数
+    M_CONNECTIONS,
+    // 因为过载停止accept(0或1)
+    M_ACCEPT_PAUSED,
+    // 过载, 描述符用完或超过MAXFDS时直接关闭(或回复503)的连接数
+    M_CONNECTIONS_SHED,
+    // 按原因统计因为超时或头部过长关闭的连接, 导出为evictions_total{reason="..."}
+    M_EVICT_REQUEST_LINE,
+    M_EVICT_HEADERS,
+    M_EVICT_BODY,
+    M_EVICT_IDLE,
+    M_EVICT_RESPONSE,
+    M_EVICT_HEADER_TOO_LARGE,
+    // 超过限流回复429的连接和请求数
+    M_RATE_LIMITED_CONNECTIONS,
+    M_RATE_LIMITED_REQUESTS,
+    // 所有连接对象及其缓冲区占用的内存(估算), 见HttpData::memoryUsage
+    M_CONNECTION_MEMORY_BYTES,
+    // 进入空闲时释放了缓冲区的次数
+    M_IDLE_COMPACTIONS,
+    // FileLoader在后台线程中完成的文件操作数, 以及等待正在进行的同一路径而没有重复操作的请求数
+    M_FILE_LOADS,
+    M_FILE_LOADS_COALESCED,
+    M_METRIC_COUNT
+};
+
+// 直方图按线程分别导出(标签thread为线程id), 不汇总
+enum HistogramId {
+    // 事件循环每一轮从poll返回到处理完事件, 就绪队列, 回调和定时器的时间
+    H_LOOP_ITERATION = 0,
+    H_HISTOGRAM_COUNT
+};
+
+// 桶的上界(微秒)见Metrics.cc, 另外还有一个+Inf桶
+const int kHistogramBuckets = 12;
+
+struct alignas(64) ThreadMetrics {
+    std::atomic<long> values[M_METRIC_COUNT];
+    struct Histogram {
+        std::atomic<long> buckets[kHistogramBuckets + 1];
+        std::atomic<long> sum;  // 微秒
+    } histograms[H_HISTOGRAM_COUNT];
+    int tid;
+};
+
+// 当前线程的指标, 第一次调用时注册
+ThreadMetrics &threadMetrics();
+
+// 只能由当前线程调用, 读-改-写不需要lock前缀
+inline void metricAdd(MetricId id, long delta) {
+    std::atomic<long> &v = threadMetrics().values[id];
+    v.store(v.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// 只能由当前线程调用
+void histogramObserve(HistogramId id, long usec);
+
+// 所有线程之和
+long metricValue(MetricId id);
+// 文本格式, 每行"名字 值", 前面有# TYPE注释; 直方图的桶是累计的, 单位为秒
+std::string formatMetrics();
@@ -0,0 +1,223 @@
+#include "MimeType.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct MimeEntry {
+    string_view ext;
+    string_view type;
+};
+
+constexpr MimeEntry kBuiltin[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"shtml", "text/html"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"mjs", "application/javascript"},
+    {"json", "application/json"},
+    {"xml", "application/xml"},
+    {"txt", "text/plain"},
+    {"c", "text/plain"},
+    {"h", "text/plain"},
+    {"cc", "text/plain"},
+    {"cpp", "text/plain"},
+    {"md", "text/markdown"},
+    {"csv", "text/csv"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"bmp", "image/bmp"},
+    {"ico", "image/x-icon"},
+    {"svg", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"mp3", "audio/mp3"},
+    {"wav", "audio/wav"},
+    {"ogg", "audio/ogg"},
+    {"m4a", "audio/mp4"},
+    {"flac", "audio/flac"},
+    {"aac", "audio/aac"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"avi", "video/x-msvideo"},
+    {"mov", "video/quicktime"},
+    {"mkv", "video/x-matroska"},
+    {"mpeg", "video/mpeg"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/x-gzip"},
+    {"tar", "application/x-tar"},
+    {"bz2", "application/x-bzip2"},
+    {"xz", "application/x-xz"},
+    {"7z", "application/x-7z-compressed"},
+    {"doc", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx", "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"rtf", "application/rtf"},
+    {"wasm", "application/wasm"},
+    {"bin", "application/octet-stream"},
+};
+const int kBuiltinCount = sizeof kBuiltin / sizeof kBuiltin[0];
+const string_view kDefaultType = "text/html";
+
+// 不超过8个字符的扩展名转小写后按字节装进一个uint64, 作为哈希和比较用的key
+// 扩展名为空或太长时返回0, 0不会出现在任何表里
+const size_t kMaxPackedExt = 8;
+
+static constexpr uint64_t packExt(string_view ext) {
+    if (ext.empty() || ext.size() > kMaxPackedExt) return 0;
+    uint64_t key = 0;
+    for (size_t i = 0; i < ext.size(); ++i) {
+        char c = ext[i];
+        if (c >= 'A' && c <= 'Z') c += 32;
+        key |= static_cast<uint64_t>(static_cast<unsigned char>(c)) << (8 * i);
+    }
+    return key;
+}
+
+const int kHashBits = 9;
+const int kHashSize = 1 << kHashBits;
+
+static constexpr unsigned mimeHash(uint64_t key, uint64_t seed) {
+    return static_cast<unsigned>((key * seed) >> (64 - kHashBits));
+}
+
+static constexpr bool seedIsPerfect(uint64_t seed) {
+    bool used[kHashSize] = {};
+    for (int i = 0; i < kBuiltinCount; ++i) {
+        unsigned h = mimeHash(packExt(kBuiltin[i].ext), seed);
+        if (used[h]) return false;
+        used[h] = true;
+    }
+    return true;
+}
+
+static constexpr uint64_t findSeed() {
+    // 相邻的seed结果高度相关, 按黄金比例跳着试
+    for (uint64_t i = 1; i < 10000; ++i) {
+        uint64_t seed = (0x9e3779b97f4a7c15ull * i) | 1;
+        if (seedIsPerfect(seed)) return seed;
+    }
+    return 0;
+}
+
+constexpr uint64_t kSeed = findSeed();
+static_assert(kSeed != 0, "no perfect hash seed for the builtin mime table");
+
+struct BuiltinTable {
+    uint64_t key[kHashSize];
+    int8_t index[kHashSize];
+};
+
+static constexpr BuiltinTable buildBuiltin() {
+    BuiltinTable t = {};
+    for (int i = 0; i < kHashSize; ++i) t.index[i] = 0;
+    for (int i = 0; i < kBuiltinCount; ++i) {
+        uint64_t key = packExt(kBuiltin[i].ext);
+        t.key[mimeHash(key, kSeed)] = key;
+        t.index[mimeHash(key, kSeed)] = static_cast<int8_t>(i);
+    }
+    return t;
+}
+
+constexpr BuiltinTable kBuiltinTable = buildBuiltin();
+
+// mime.types补充的扩展名, 开放寻址, 装载因子不超过1/2, loadFile之后不再修改
+struct ExtraTable {
+    vector<uint64_t> keys;
+    vector<uint32_t> typeIndex;
+    vector<string> types;
+    uint64_t mask = 0;
+};
+
+static ExtraTable g_extra;
+
+static uint64_t extraSlot(const ExtraTable &t, uint64_t key) {
+    return ((key * kSeed) >> 32) & t.mask;
+}
+
+static bool extraInsert(ExtraTable &t, uint64_t key, uint32_t type) {
+    for (uint64_t i = extraSlot(t, key);; i = (i + 1) & t.mask) {
+        if (t.keys[i] == key) return false;
+        if (t.keys[i] == 0) {
+            t.keys[i] = key;
+            t.typeIndex[i] = type;
+            return true;
+        }
+    }
+}
+
+string_view MimeType::getMime(string_view suffix) {
+    uint64_t key = packExt(suffix);
+    if (key == 0) return kDefaultType;
+    unsigned h = mimeHash(key, kSeed);
+    if (kBuiltinTable.key[h] == key) return kBuiltin[kBuiltinTable.index[h]].type;
+    if (g_extra.mask != 0) {
+        for (uint64_t i = extraSlot(g_extra, key); g_extra.keys[i] != 0;
+             i = (i + 1) & g_extra.mask)
+            if (g_extra.keys[i] == key) return g_extra.types[g_extra.typeIndex[i]];
+    }
+    return kDefaultType;
+}
+
+string_view MimeType::forPath(string_view path) {
+    size_t dot = path.rfind('.');
+    if (dot == string_view::npos) return kDefaultType;
+    size_t slash = path.rfind('/');
+    if (slash != string_view::npos && slash > dot) return kDefaultType;
+    return getMime(path.substr(dot + 1));
+}
+
+int MimeType::loadFile(const char *path) {
+    FILE *fp = fopen(path, "re");
+    if (fp == NULL) return -1;
+    // 先收集(扩展名, 类型), 最后一次性建表
+    vector<pair<uint64_t, uint32_t>> entries;
+    vector<string> types;
+    char line[1024];
+    while (fgets(line, sizeof line, fp) != NULL) {
+        char *save = NULL;
+        char *type = strtok_r(line, " \t\r\n", &save);
+        if (type == NULL || type[0] == '#') continue;
+        bool added = false;
+        for (char *ext = strtok_r(NULL, " \t\r\n", &save); ext != NULL;
+             ext = strtok_r(NULL, " \t\r\n", &save)) {
+            uint64_t key = packExt(ext);
+            // 太长的扩展名和内置表已有的扩展名跳过
+            if (key == 0 || kBuiltinTable.key[mimeHash(key, kSeed)] == key) continue;
+            if (!added) {
+                types.push_back(type);
+                added = true;
+            }
+            entries.push_back(make_pair(key, static_cast<uint32_t>(types.size() - 1)));
+        }
+    }
+    fclose(fp);
+
+    ExtraTable t;
+    size_t size = 16;
+    while (size < entries.size() * 2) size <<= 1;
+    t.keys.assign(size, 0);
+    t.typeIndex.assign(size, 0);
+    t.mask = size - 1;
+    int added = 0;
+    for (auto &e : entries)
+        if (extraInsert(t, e.first, e.second)) ++added;
+    t.types.swap(types);
+    g_extra = std::move(t);
+    return added;
+}
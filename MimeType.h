@@ -0,0 +1,19 @@
+#pragma once
+#include <string_view>
+
+// 扩展名到Content-Type的映射
+// 常用类型在编译期生成完美哈希表; 启动时可以再从mime.types补充一张冻结的表,
+// 之后两张表都只读, 各线程查找不加锁也不分配内存
+class MimeType {
+public:
+    // suffix不含'.', 大小写不敏感, 未知类型返回text/html
+    static std::string_view getMime(std::string_view suffix);
+    // 按路径最后一个'.'之后的部分查找, 目录名中的'.'不算
+    static std::string_view forPath(std::string_view path);
+    // 只能在工作线程启动前调用, 再次调用替换上次补充的表; 内置表里已有的扩展名不覆盖
+    // 返回补充的扩展名个数, 文件打不开时返回-1
+    static int loadFile(const char *path);
+
+private:
+    MimeType();
+};
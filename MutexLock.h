@@ -30,4 +30,22 @@ public:
 
 private:
     MutexLock &mutex;
+};
+
+// 单线程配置中代替MutexLock, 加锁和解锁什么也不做
+class NullMutexLock : noncopyable {
+public:
+    void lock() {}
+    void unlock() {}
+};
+
+// 锁的类型由模板参数决定, 用于按ServerPolicy选择锁的地方
+template <typename Mutex>
+class LockGuard : noncopyable {
+public:
+    explicit LockGuard(Mutex &mutex) : mutex_(mutex) { mutex_.lock(); }
+    ~LockGuard() { mutex_.unlock(); }
+
+private:
+    Mutex &mutex_;
 };
\ No newline at end of file
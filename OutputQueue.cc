@@ -0,0 +1,180 @@
+#include "OutputQueue.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include "MappedFile.h"
+#include "Util.h"
+
+void OutputQueue::append(const char *data, size_t len) {
+    if (len == 0) return;
+    bytes_ += len;
+    if (!empty()) {
+        Segment &last = segments_.back();
+        // 字符串段只保存未发送的部分: str的末尾len个字节
+        if (last.type == SEG_STRING && last.len + len <= kCoalesceLimit) {
+            last.str.append(data, len);
+            last.len += len;
+            return;
+        }
+    }
+    Segment seg;
+    seg.type = SEG_STRING;
+    seg.str.assign(data, len);
+    seg.data = NULL;
+    seg.offset = 0;
+    seg.len = len;
+    segments_.push_back(std::move(seg));
+}
+
+void OutputQueue::append(std::string &&str) {
+    if (str.size() <= kCoalesceLimit) {
+        append(str.data(), str.size());
+        return;
+    }
+    bytes_ += str.size();
+    Segment seg;
+    seg.type = SEG_STRING;
+    seg.len = str.size();
+    seg.str = std::move(str);
+    seg.data = NULL;
+    seg.offset = 0;
+    segments_.push_back(std::move(seg));
+}
+
+void OutputQueue::appendStatic(const char *data, size_t len) {
+    if (len == 0) return;
+    bytes_ += len;
+    Segment seg;
+    seg.type = SEG_STATIC;
+    seg.data = data;
+    seg.offset = 0;
+    seg.len = len;
+    segments_.push_back(std::move(seg));
+}
+
+void OutputQueue::appendFile(const std::shared_ptr<MappedFile> &file,
+                             off_t offset, size_t len) {
+    if (len == 0) return;
+    bytes_ += len;
+    Segment seg;
+    seg.type = SEG_FILE;
+    seg.data = NULL;
+    seg.file = file;
+    seg.offset = offset;
+    seg.len = len;
+    segments_.push_back(std::move(seg));
+}
+
+void OutputQueue::clear() {
+    segments_.clear();
+    head_ = 0;
+    bytes_ = 0;
+}
+
+void OutputQueue::shrink() {
+    if (empty()) {
+        std::vector<Segment>().swap(segments_);
+        head_ = 0;
+    }
+}
+
+size_t OutputQueue::memoryUsage() const {
+    size_t n = segments_.capacity() * sizeof(Segment);
+    for (size_t i = head_; i < segments_.size(); ++i) n += stringHeapBytes(segments_[i].str);
+    return n;
+}
+
+void OutputQueue::consume(size_t n) {
+    bytes_ -= n;
+    while (n > 0) {
+        Segment &seg = segments_[head_];
+        size_t used = n < seg.len ? n : seg.len;
+        switch (seg.type) {
+        case SEG_STRING:
+            break;
+        case SEG_STATIC:
+            seg.data += used;
+            break;
+        case SEG_FILE:
+            seg.offset += used;
+            break;
+        }
+        seg.len -= used;
+        n -= used;
+        if (seg.len == 0) {
+            // 立即释放字符串和文件映射的引用, 段本身留到队列清空或前部过长时再删除
+            seg = Segment();
+            if (++head_ == segments_.size()) {
+                segments_.clear();
+                head_ = 0;
+            } else if (head_ >= 16 && head_ * 2 >= segments_.size()) {
+                segments_.erase(segments_.begin(), segments_.begin() + head_);
+                head_ = 0;
+            }
+        } else if (seg.type == SEG_STRING && seg.str.size() - seg.len > kCoalesceLimit) {
+            // 已发送的前缀过长时才真正删除, 避免每次都移动内存
+            seg.str.erase(0, seg.str.size() - seg.len);
+        }
+    }
+}
+
+ssize_t OutputQueue::flush(int fd) {
+    ssize_t writeSum = 0;
+    while (!empty()) {
+        struct iovec iov[kMaxIov];
+        // 本批中已经引用了映射窗口的文件
+        const MappedFile *files[kMaxIov];
+        int fileCnt = 0;
+        int cnt = 0;
+        size_t total = 0;
+        bool partial = false;
+        for (size_t i = head_; i < segments_.size() && cnt < kMaxIov; ++i) {
+            Segment &seg = segments_[i];
+            const char *p = NULL;
+            size_t len = seg.len;
+            if (seg.type == SEG_STRING) {
+                p = seg.str.data() + (seg.str.size() - seg.len);
+            } else if (seg.type == SEG_STATIC) {
+                p = seg.data;
+            } else {
+                // 每个MappedFile只有一个窗口: 同一文件的另一个窗口(如多区间的Range)留到下一轮,
+                // 否则重新映射后前面的iov指向已经解除(或被新窗口复用)的内存, 发出错误的数据
+                if (!seg.file->mapped(seg.offset) &&
+                    std::find(files, files + fileCnt, seg.file.get()) != files + fileCnt)
+                    break;
+                files[fileCnt++] = seg.file.get();
+                // 文件段每次最多提供一个映射窗口, 后面的段留到下一轮
+                size_t avail = 0;
+                p = seg.file->data(seg.offset, &avail);
+                if (p == NULL) return -1;
+                if (avail < len) {
+                    len = avail;
+                    partial = true;
+                }
+            }
+            iov[cnt].iov_base = const_cast<char *>(p);
+            iov[cnt].iov_len = len;
+            ++cnt;
+            total += len;
+            if (partial) break;
+        }
+        // 后面还有数据时使用MSG_MORE, 让内核把头部和文件内容合并成满载的报文段
+        bool more = partial || head_ + cnt < segments_.size();
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return -1;
+        }
+        writeSum += n;
+        consume(n);
+        if (static_cast<size_t>(n) < total) break;
+    }
+    return writeSum;
+}
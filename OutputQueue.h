@@ -0,0 +1,52 @@
+#pragma once
+#include <sys/types.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "noncopyable.h"
+
+class MappedFile;
+
+// 连接的输出队列, 由若干段组成: 自有的字符串, 静态数据(不拷贝), 文件区间
+// flush时把尽可能多的段放进一个iovec数组, 一次sendmsg发送
+class OutputQueue : noncopyable {
+public:
+    OutputQueue() : head_(0), bytes_(0) {}
+
+    void append(const char *data, size_t len);
+    void append(const std::string &str) { append(str.data(), str.size()); }
+    void append(std::string &&str);
+    // data必须在整个连接期间有效, 例如.rodata中的常量
+    void appendStatic(const char *data, size_t len);
+    void appendFile(const std::shared_ptr<MappedFile> &file, off_t offset, size_t len);
+
+    // 返回写出的字节数, 出错返回-1; 内核缓冲区满时返回, 剩余部分留在队列中
+    ssize_t flush(int fd);
+    void clear();
+    bool empty() const { return head_ == segments_.size(); }
+    size_t bytes() const { return bytes_; }
+    // 队列为空时释放段数组, 用于空闲的长连接
+    void shrink();
+    // 段数组和字符串段占用的堆内存
+    size_t memoryUsage() const;
+
+private:
+    enum SegmentType { SEG_STRING, SEG_STATIC, SEG_FILE };
+    struct Segment {
+        SegmentType type;
+        std::string str;
+        const char *data;
+        std::shared_ptr<MappedFile> file;
+        off_t offset;
+        size_t len;  // 剩余未发送的字节数
+    };
+    void consume(size_t n);
+
+    // 小于该长度的字符串直接拼接到上一个字符串段, 减少iovec数量
+    static const size_t kCoalesceLimit = 16 * 1024;
+    static const int kMaxIov = 64;
+    // 已发送的段在head_之前, 队列发送完时整体清空; 不用deque, 空队列不占用堆内存
+    std::vector<Segment> segments_;
+    size_t head_;
+    size_t bytes_;
+};
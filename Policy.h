@@ -0,0 +1,34 @@
+#pragma once
+
+// 编译期选择的实现(策略). 整个库和使用它的程序必须用同一个WEBSERVER_POLICY编译,
+// 默认是DefaultPolicy; 例如 -DWEBSERVER_POLICY=MaxPerfPolicy (见Makefile的max-perf)
+// 各实现都是具体类型, 调用都是直接的, 不需要虚函数
+
+class Epoll;
+class TimerManager;
+class AsyncLogging;
+class MutexLock;
+class NullMutexLock;
+
+struct DefaultPolicy {
+    typedef Epoll Poller;           // EventLoop的IO多路复用
+    typedef TimerManager TimerQueue;  // Poller中连接的超时
+    typedef AsyncLogging LogSink;   // LOG的输出
+    typedef MutexLock Mutex;        // EventLoop待执行函数队列的锁
+    static const bool kLogging = true;
+    // 为false时只有主线程一个EventLoop, Server不创建IO线程
+    static const bool kMultiThread = true;
+};
+
+// 单线程, 不加锁, 去掉日志; 其它线程不能调用EventLoop的runInLoop/queueInLoop
+struct MaxPerfPolicy : DefaultPolicy {
+    typedef NullMutexLock Mutex;
+    static const bool kLogging = false;
+    static const bool kMultiThread = false;
+};
+
+#ifndef WEBSERVER_POLICY
+#define WEBSERVER_POLICY DefaultPolicy
+#endif
+
+typedef WEBSERVER_POLICY ServerPolicy;
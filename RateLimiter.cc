@@ -0,0 +1,86 @@
+#include "RateLimiter.h"
+#include <algorithm>
+
+using namespace std;
+
+void RateLimiter::configure(int rate, int burst, size_t capacity) {
+    rate_ = rate > 0 ? rate : 0;
+    burst_ = static_cast<int64_t>(burst > 0 ? burst : 1) * kUnit;
+    if (capacity == 0) capacity = 1;
+    // 哈希表的桶数取不小于容量的2的幂(至少2), 平均链长不超过1
+    size_t n = 2;
+    shift_ = 63;
+    while (n < capacity) {
+        n <<= 1;
+        --shift_;
+    }
+    buckets_.assign(n, -1);
+    entries_.assign(capacity, Entry());
+    lruHead_ = lruTail_ = -1;
+    used_ = 0;
+}
+
+int32_t RateLimiter::find(uint32_t addr, size_t bucket) const {
+    for (int32_t i = buckets_[bucket]; i >= 0; i = entries_[i].next)
+        if (entries_[i].addr == addr) return i;
+    return -1;
+}
+
+void RateLimiter::unlinkLru(int32_t i) {
+    Entry &e = entries_[i];
+    if (e.lruPrev >= 0)
+        entries_[e.lruPrev].lruNext = e.lruNext;
+    else
+        lruHead_ = e.lruNext;
+    if (e.lruNext >= 0)
+        entries_[e.lruNext].lruPrev = e.lruPrev;
+    else
+        lruTail_ = e.lruPrev;
+}
+
+void RateLimiter::pushFront(int32_t i) {
+    Entry &e = entries_[i];
+    e.lruPrev = -1;
+    e.lruNext = lruHead_;
+    if (lruHead_ >= 0) entries_[lruHead_].lruPrev = i;
+    lruHead_ = i;
+    if (lruTail_ < 0) lruTail_ = i;
+}
+
+// 从哈希链和LRU中摘下最久没有出现的一项, 返回它的下标
+int32_t RateLimiter::evict() {
+    int32_t victim = lruTail_;
+    unlinkLru(victim);
+    int32_t *link = &buckets_[bucketOf(entries_[victim].addr)];
+    while (*link != victim) link = &entries_[*link].next;
+    *link = entries_[victim].next;
+    return victim;
+}
+
+bool RateLimiter::allow(uint32_t addr, int64_t nowUs) {
+    if (rate_ == 0) return true;
+    size_t bucket = bucketOf(addr);
+    int32_t i = find(addr, bucket);
+    if (i < 0) {
+        i = used_ < entries_.size() ? static_cast<int32_t>(used_++) : evict();
+        Entry &e = entries_[i];
+        e.addr = addr;
+        e.next = buckets_[bucket];
+        buckets_[bucket] = i;
+        e.tokens = burst_;
+        e.last = nowUs;
+    } else {
+        unlinkLru(i);
+    }
+    pushFront(i);
+    Entry &e = entries_[i];
+    if (nowUs > e.last) {
+        // 空闲很久的客户端直接补满, 避免乘法溢出
+        int64_t elapsed = nowUs - e.last;
+        e.tokens = elapsed >= burst_ / rate_ ? burst_ : min(burst_, e.tokens + elapsed * rate_);
+        e.last = nowUs;
+    }
+    if (e.tokens < kUnit) return false;
+    e.tokens -= kUnit;
+    return true;
+}
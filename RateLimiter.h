@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "noncopyable.h"
+
+// 按客户端IPv4地址的令牌桶限流, 每个EventLoop一份, 只在所属线程使用, 不需要加锁
+// 固定容量的链式哈希表, 表项都在构造时分配好; 表满时淘汰最久没有出现的客户端(LRU)
+// 令牌在访问时按经过的时间补充, 不需要定时扫描; 被淘汰的客户端再出现时桶是满的
+class RateLimiter : noncopyable {
+public:
+    RateLimiter() : rate_(0), burst_(0), shift_(63), lruHead_(-1), lruTail_(-1), used_(0) {}
+
+    // rate为每秒补充的令牌数, 为0时不限制; burst为桶的容量; capacity为记录的客户端数上限
+    void configure(int rate, int burst, size_t capacity);
+    bool enabled() const { return rate_ > 0; }
+
+    // 取走一个令牌, 桶空时返回false. addr为网络字节序, nowUs为单调时钟(微秒)
+    bool allow(uint32_t addr, int64_t nowUs);
+
+    size_t size() const { return used_; }
+
+private:
+    // 令牌以"个 * 1e6"为单位, 按微秒补充时不需要浮点运算
+    static const int64_t kUnit = 1000000;
+
+    struct Entry {
+        uint32_t addr;
+        int32_t next;     // 同一哈希链的下一项
+        int32_t lruPrev;  // 越靠前越是最近出现的
+        int32_t lruNext;
+        int64_t tokens;
+        int64_t last;     // 上次补充令牌的时间
+    };
+
+    // 取乘积的高位, 网络字节序的低位(第一段)相同的地址也能分散开
+    size_t bucketOf(uint32_t addr) const { return (addr * 0x9E3779B97F4A7C15ull) >> shift_; }
+    int32_t find(uint32_t addr, size_t bucket) const;
+    int32_t evict();
+    void unlinkLru(int32_t i);
+    void pushFront(int32_t i);
+
+    int64_t rate_;
+    int64_t burst_;
+    int shift_;
+    std::vector<int32_t> buckets_;
+    std::vector<Entry> entries_;
+    int32_t lruHead_;
+    int32_t lruTail_;
+    size_t used_;
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <assert.h>
+#include <stddef.h>
+#include <utility>
+#include "CurrentThread.h"
+#include "noncopyable.h"
+
+// 单线程的侵入式引用计数, 用于连接这类只在所属IO线程中使用的对象
+// 计数不是原子的: 对象在哪个线程创建, 就只能在哪个线程引用和释放;
+// 其它线程要引用它时使用不持有计数的句柄(如ConnectionHandle), 回到所属线程再查找
+// 调试版本(没有定义NDEBUG)检查线程和计数
+template <typename T>
+class RefCounted : noncopyable {
+public:
+    void addRef() const {
+        assertOwner();
+        ++refs_;
+    }
+    void release() const {
+        assertOwner();
+        assert(refs_ > 0);
+        if (--refs_ == 0) delete static_cast<const T *>(this);
+    }
+    int refCount() const { return refs_; }
+
+protected:
+    RefCounted() : refs_(0) {
+#ifndef NDEBUG
+        owner_ = CurrentThread::tid();
+#endif
+    }
+    // 只能由release删除
+    ~RefCounted() { assert(refs_ == 0); }
+
+private:
+    void assertOwner() const {
+#ifndef NDEBUG
+        assert(owner_ == CurrentThread::tid());
+#endif
+    }
+
+    mutable int refs_;
+#ifndef NDEBUG
+    int owner_;
+#endif
+};
+
+// 持有一个引用, 用法同shared_ptr; 可以从裸指针构造, 计数在对象内部
+template <typename T>
+class Ref {
+public:
+    Ref() : ptr_(NULL) {}
+    explicit Ref(T *p) : ptr_(p) {
+        if (ptr_) ptr_->addRef();
+    }
+    Ref(const Ref &other) : ptr_(other.ptr_) {
+        if (ptr_) ptr_->addRef();
+    }
+    Ref(Ref &&other) noexcept : ptr_(other.ptr_) { other.ptr_ = NULL; }
+    ~Ref() {
+        if (ptr_) ptr_->release();
+    }
+    Ref &operator=(Ref other) {
+        swap(other);
+        return *this;
+    }
+
+    void reset() { Ref().swap(*this); }
+    void swap(Ref &other) { std::swap(ptr_, other.ptr_); }
+    T *get() const { return ptr_; }
+    T *operator->() const { return ptr_; }
+    T &operator*() const { return *ptr_; }
+    explicit operator bool() const { return ptr_ != NULL; }
+
+private:
+    T *ptr_;
+};
@@ -0,0 +1,8 @@
+#include "ResponseHeader.h"
+
+void HeaderCache::refreshDate(time_t now) {
+    struct tm tm_time;
+    gmtime_r(&now, &tm_time);
+    dateLen_ = strftime(date_, sizeof date_, "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm_time);
+    cachedSec_ = now;
+}
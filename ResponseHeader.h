@@ -0,0 +1,92 @@
+#pragma once
+#include <string.h>
+#include <time.h>
+#include <string_view>
+#include "LogStream.h"
+#include "noncopyable.h"
+
+// 编译期确定的状态行和常用头部片段, 拼接响应头时直接memcpy
+inline constexpr std::string_view kStatus200 = "HTTP/1.1 200 OK\r\n";
+inline constexpr std::string_view kStatus206 = "HTTP/1.1 206 Partial Content\r\n";
+inline constexpr std::string_view kStatus304 = "HTTP/1.1 304 Not Modified\r\n";
+inline constexpr std::string_view kStatus416 = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+// 对Expect: 100-continue的临时响应, 没有头部
+inline constexpr std::string_view kContinueResponse = "HTTP/1.1 100 Continue\r\n\r\n";
+// 超过限流时的完整响应, 随后关闭连接
+inline constexpr std::string_view kTooManyRequestsResponse =
+    "HTTP/1.1 429 Too Many Requests\r\nRetry-After: 1\r\nContent-Length: 0\r\n"
+    "Connection: Close\r\n\r\n";
+inline constexpr std::string_view kServerHeader = "Server: Ekko's Web Server\r\n";
+inline constexpr std::string_view kCloseHeader = "Connection: Close\r\n";
+inline constexpr std::string_view kAcceptRangesHeader = "Accept-Ranges: bytes\r\n";
+
+// 每个EventLoop一份, 缓存格式化好的"Date: ...\r\n"
+// 时间取自loop每轮poll返回时记录的时钟, 秒数变化时才重新格式化
+class HeaderCache : noncopyable {
+public:
+    HeaderCache() : cachedSec_(-1), dateLen_(0) {}
+    std::string_view dateLine(time_t now) {
+        if (now != cachedSec_) refreshDate(now);
+        return std::string_view(date_, dateLen_);
+    }
+
+private:
+    void refreshDate(time_t now);
+
+    time_t cachedSec_;
+    size_t dateLen_;
+    char date_[64];
+};
+
+// 在栈上拼接响应头, 完成后一次追加到输出队列
+// 超出kCapacity时不再写入并记下overflowed(), 调用者不能发出这样的头部
+// (handler提供的reason和Content-Type长度不受限制), 应改为返回500
+class HeaderWriter : noncopyable {
+public:
+    static const size_t kCapacity = 2048;
+
+    HeaderWriter() : len_(0), overflowed_(false) {}
+
+    HeaderWriter &operator<<(std::string_view s) {
+        if (len_ + s.size() <= kCapacity) {
+            memcpy(buf_ + len_, s.data(), s.size());
+            len_ += s.size();
+        } else {
+            overflowed_ = true;
+        }
+        return *this;
+    }
+    HeaderWriter &operator<<(char c) {
+        if (len_ < kCapacity)
+            buf_[len_++] = c;
+        else
+            overflowed_ = true;
+        return *this;
+    }
+    HeaderWriter &operator<<(int v) { return formatInteger(v); }
+    HeaderWriter &operator<<(long v) { return formatInteger(v); }
+    HeaderWriter &operator<<(unsigned long v) { return formatInteger(v); }
+
+    const char *data() const { return buf_; }
+    size_t size() const { return len_; }
+    bool overflowed() const { return overflowed_; }
+    void reset() {
+        len_ = 0;
+        overflowed_ = false;
+    }
+
+private:
+    template <typename T>
+    HeaderWriter &formatInteger(T v) {
+        // convert会多写一个'\0', 所以缓冲区多留一个字节
+        if (len_ + LogStream::kMaxNumericSize <= kCapacity)
+            len_ += convert(buf_ + len_, v);
+        else
+            overflowed_ = true;
+        return *this;
+    }
+
+    size_t len_;
+    bool overflowed_;
+    char buf_[kCapacity + 1];
+};
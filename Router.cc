@@ -0,0 +1,157 @@
+#include "Router.h"
+#include <string.h>
+
+using namespace std;
+
+struct Router::Node {
+    string prefix;   // 压缩后的静态边, 由父节点匹配
+    string indices;  // 各静态子节点prefix的首字节, 与children一一对应
+    vector<unique_ptr<Node>> children;
+    unique_ptr<Node> param;     // ":name", 只匹配一段
+    unique_ptr<Node> wildcard;  // "*", 一定是叶子
+    const Route *route = NULL;
+};
+
+Router::Router() {
+    for (int i = 0; i < kMethodCount; ++i) roots_[i].reset(new Node);
+}
+
+Router::~Router() {}
+
+bool Router::add(HttpMethod method, string_view pattern, RouteHandler handler) {
+    unique_ptr<Route> route(new Route);
+    route->handler = std::move(handler);
+    return addRoute(method, pattern, std::move(route));
+}
+
+bool Router::addStream(HttpMethod method, string_view pattern, StreamHandler handler) {
+    unique_ptr<Route> route(new Route);
+    route->streamHandler = std::move(handler);
+    return addRoute(method, pattern, std::move(route));
+}
+
+bool Router::addRoute(HttpMethod method, string_view pattern, unique_ptr<Route> route) {
+    if (method < 0 || method >= kMethodCount || pattern.empty() || pattern[0] != '/')
+        return false;
+    // 参数段和通配段只能出现在'/'之后, 通配段只能在结尾
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != ':' && pattern[i] != '*') continue;
+        if (pattern[i - 1] != '/') return false;
+        if (pattern[i] == '*') {
+            if (i + 1 != pattern.size()) return false;
+            route->paramNames.push_back("*");
+        } else {
+            size_t end = pattern.find('/', i);
+            if (end == string_view::npos) end = pattern.size();
+            if (end == i + 1) return false;
+            string_view name = pattern.substr(i + 1, end - i - 1);
+            if (name.find_first_of(":*") != string_view::npos) return false;
+            route->paramNames.push_back(string(name));
+        }
+    }
+    if (route->paramNames.size() > static_cast<size_t>(RouteMatch::kMaxParams)) return false;
+
+    Node *n = roots_[method].get();
+    while (!pattern.empty()) {
+        if (pattern[0] == ':') {
+            size_t end = pattern.find('/');
+            if (end == string_view::npos) end = pattern.size();
+            if (!n->param) n->param.reset(new Node);
+            n = n->param.get();
+            pattern.remove_prefix(end);
+            continue;
+        }
+        if (pattern[0] == '*') {
+            if (!n->wildcard) n->wildcard.reset(new Node);
+            n = n->wildcard.get();
+            pattern.remove_prefix(1);
+            continue;
+        }
+        // 到下一个参数段或通配段为止的静态部分
+        string_view run = pattern.substr(0, pattern.find_first_of(":*"));
+        size_t i = n->indices.find(run[0]);
+        if (i == string::npos) {
+            Node *child = new Node;
+            child->prefix.assign(run.data(), run.size());
+            n->indices += run[0];
+            n->children.emplace_back(child);
+            n = child;
+            pattern.remove_prefix(run.size());
+            continue;
+        }
+        Node *child = n->children[i].get();
+        size_t common = 0;
+        while (common < run.size() && common < child->prefix.size() &&
+               run[common] == child->prefix[common])
+            ++common;
+        if (common < child->prefix.size()) {
+            // 在公共前缀处把已有的边分成两段
+            unique_ptr<Node> split(new Node);
+            split->prefix = child->prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            split->indices += child->prefix[0];
+            split->children.push_back(std::move(n->children[i]));
+            n->children[i] = std::move(split);
+            child = n->children[i].get();
+        }
+        n = child;
+        pattern.remove_prefix(common);
+    }
+    if (n->route != NULL) return false;
+    n->route = route.get();
+    routes_.push_back(std::move(route));
+    return true;
+}
+
+// n的prefix已经由调用者匹配, path为剩余部分
+bool Router::matchNode(const Node *n, string_view path, RouteMatch &m) {
+    if (path.empty() && n->route != NULL) {
+        m.handler = &n->route->handler;
+        m.streamHandler = n->route->streamHandler ? &n->route->streamHandler : NULL;
+        m.paramNames = &n->route->paramNames;
+        return true;
+    }
+    if (!path.empty()) {
+        // 子节点通常只有几个, 直接顺序比较首字节
+        size_t i = 0;
+        while (i < n->indices.size() && n->indices[i] != path[0]) ++i;
+        if (i < n->indices.size()) {
+            const Node *child = n->children[i].get();
+            size_t len = child->prefix.size();
+            if (path.size() >= len && memcmp(path.data(), child->prefix.data(), len) == 0 &&
+                matchNode(child, path.substr(len), m))
+                return true;
+        }
+        if (n->param) {
+            size_t end = path.find('/');
+            if (end == string_view::npos) end = path.size();
+            if (end > 0 && m.paramCount < RouteMatch::kMaxParams) {
+                m.params[m.paramCount++] = path.substr(0, end);
+                if (matchNode(n->param.get(), path.substr(end), m)) return true;
+                --m.paramCount;
+            }
+        }
+    }
+    if (n->wildcard && n->wildcard->route != NULL && m.paramCount < RouteMatch::kMaxParams) {
+        const Route *route = n->wildcard->route;
+        m.params[m.paramCount++] = path;
+        m.handler = &route->handler;
+        m.streamHandler = route->streamHandler ? &route->streamHandler : NULL;
+        m.paramNames = &route->paramNames;
+        return true;
+    }
+    return false;
+}
+
+bool Router::match(HttpMethod method, string_view path, RouteMatch &m) const {
+    m.paramCount = 0;
+    if (method < 0 || method >= kMethodCount) return false;
+    return matchNode(roots_[method].get(), path, m);
+}
+
+bool Router::matchAnyMethod(string_view path) const {
+    RouteMatch m;
+    for (int i = 0; i < kMethodCount; ++i)
+        if (match(static_cast<HttpMethod>(i), path, m)) return true;
+    return false;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "HttpParser.h"
+#include "noncopyable.h"
+
+class HttpRequest;
+class HttpResponse;
+class BodySink;
+typedef std::function<void(const HttpRequest &, HttpResponse &)> RouteHandler;
+// 流式路由在头部解析完后调用, 返回接收body的BodySink, 见HttpHandler.h
+typedef std::function<std::shared_ptr<BodySink>(const HttpRequest &, HttpResponse &)>
+    StreamHandler;
+
+// 一次匹配的结果, 参数值直接指向请求路径, 不拷贝
+struct RouteMatch {
+    static const int kMaxParams = 8;
+    const RouteHandler *handler;
+    // 流式路由不为NULL, 此时handler为空
+    const StreamHandler *streamHandler;
+    // 按在模式中出现的顺序, 结尾通配部分的名字为"*"
+    const std::vector<std::string> *paramNames;
+    int paramCount;
+    std::string_view params[kMaxParams];
+};
+
+// 每个方法一棵压缩前缀树
+// 模式以'/'开头, 由三种段组成: 静态段"/a/b", 参数段"/user/:id"(匹配一段, 不含'/'),
+// 以及结尾的通配"/static/*"(匹配剩余部分, 可以为空)
+// 匹配优先级为 静态 > 参数 > 通配, 走不通时回溯
+// 所有路由在Server::start之前注册完毕, 之后只读, 各线程共享不加锁
+class Router : noncopyable {
+public:
+    Router();
+    ~Router();
+
+    // 模式不合法或与已有路由重复时返回false
+    bool add(HttpMethod method, std::string_view pattern, RouteHandler handler);
+    bool addStream(HttpMethod method, std::string_view pattern, StreamHandler handler);
+    // path以'/'开头, 不含查询串
+    bool match(HttpMethod method, std::string_view path, RouteMatch &m) const;
+    // 其他方法能否匹配, 用于区分404和405
+    bool matchAnyMethod(std::string_view path) const;
+    size_t size() const { return routes_.size(); }
+
+private:
+    static const int kMethodCount = METHOD_HEAD + 1;
+    struct Node;
+    struct Route {
+        RouteHandler handler;
+        StreamHandler streamHandler;
+        std::vector<std::string> paramNames;
+    };
+
+    bool addRoute(HttpMethod method, std::string_view pattern, std::unique_ptr<Route> route);
+    static bool matchNode(const Node *n, std::string_view path, RouteMatch &m);
+
+    std::unique_ptr<Node> roots_[kMethodCount];
+    std::vector<std::unique_ptr<Route>> routes_;
+};
@@ -1,11 +1,21 @@
 #include "Server.h"
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <algorithm>
 #include <functional>
+#include "HttpData.h"
+#include "Metrics.h"
+#include "ResponseHeader.h"
 #include "Util.h"
 #include "Logging.h"
 
+// 停止accept期间检查负载的间隔
+const long OVERLOAD_CHECK_INTERVAL = 100;  // ms
+
 Server::Server(EventLoop *loop, int threadNum, int port)
     : loop_(loop),
       threadNum_(threadNum),
@@ -13,38 +23,128 @@ Server::Server(EventLoop *loop, int threadNum, int port)
       started_(false),
       acceptChannel_(new Channel(loop_)),
       port_(port),
-      listenFd_(socket_bind_listen(port_)) {
+      listenFd_(socket_bind_listen(port_)),
+      idleFd_(open("/dev/null", O_RDONLY | O_CLOEXEC)),
+      timerFd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      timerChannel_(new Channel(loop_, timerFd_)),
+      overloaded_(false),
+      acceptPaused_(false) {
     acceptChannel_->setFd(listenFd_);
     handle_for_sigpipe();
     if (setSocketNonBlocking(listenFd_) < 0) {
         perror("set socket non block failed");
         abort();
     }
+    if (timerFd_ < 0) {
+        perror("timerfd_create failed");
+        abort();
+    }
+}
+
+Server::~Server() {
+    close(timerFd_);
+    if (idleFd_ >= 0) close(idleFd_);
+}
+
+bool Server::addRoute(HttpMethod method, std::string_view pattern, RouteHandler handler) {
+    assert(!started_);
+    if (!router_.add(method, pattern, std::move(handler))) {
+        LOG << "Invalid or duplicate route " << std::string(pattern);
+        return false;
+    }
+    return true;
+}
+
+bool Server::addStreamRoute(HttpMethod method, std::string_view pattern,
+                            StreamHandler handler) {
+    assert(!started_);
+    if (!router_.addStream(method, pattern, std::move(handler))) {
+        LOG << "Invalid or duplicate route " << std::string(pattern);
+        return false;
+    }
+    return true;
+}
+
+void Server::setOptions(const HttpOptions &options) {
+    assert(!started_);
+    options_ = options;
+    if (options_.readChunkSize == 0) options_.readChunkSize = 1;
 }
 
 void Server::start() {
     eventLoopThreadPool_->start();
+    loop_->setFunctorBudget(options_.loopFunctorBudgetUs);
+    connectionLimiter_.configure(options_.connectionsPerSec, options_.connectionBurst,
+                                 options_.rateLimitClients);
+    // 单线程配置中没有其它线程可以投递结果
+    if (options_.fileIoThreads > 0 && ServerPolicy::kMultiThread) {
+        fileLoader_.reset(new FileLoader(options_.fileIoThreads, options_.fileIoPrefetchBytes));
+        fileLoader_->start();
+    }
+    const HttpOptions *options = &options_;
+    FileLoader *fileLoader = fileLoader_.get();
+    for (EventLoop *loop : eventLoopThreadPool_->getAllLoops()) {
+        loop->runInLoop([loop, options, fileLoader] {
+            loop->setFileLoader(fileLoader);
+            loop->setFunctorBudget(options->loopFunctorBudgetUs);
+            loop->rateLimiter().configure(options->requestsPerSec, options->requestBurst,
+                                          options->rateLimitClients);
+        });
+    }
     // acceptChannel_->setEvents(EPOLLIN | EPOLLET | EPOLLONESHOT);
     acceptChannel_->setEvents(EPOLLIN | EPOLLET);
-    acceptChannel_->setReadHandler(std::bind(&Server::handNewConn, this));
-    acceptChannel_->setConnHandler(std::bind(&Server::handThisConn, this));
-    loop_->addToPoller(acceptChannel_, 0);
+    acceptChannel_->setAcceptor(this);
+    loop_->addToPoller(acceptChannel_.get(), 0);
+    timerChannel_->setTimer(this);
+    loop_->addToPoller(timerChannel_.get(), 0);
+    if (options_.overloadRetryAfter > 0) {
+        overloadResponse_ = "HTTP/1.1 503 Service Unavailable\r\n";
+        overloadResponse_ += kServerHeader;
+        overloadResponse_ += "Retry-After: " + std::to_string(options_.overloadRetryAfter) + "\r\n";
+        overloadResponse_ += "Content-Length: 0\r\n";
+        overloadResponse_ += kCloseHeader;
+        overloadResponse_ += "\r\n";
+    }
     started_ = true;
 }
 
 void Server::handNewConn() {
     struct sockaddr_in client_addr;
-    memset(&client_addr, 0, sizeof(struct sockaddr_in));
-    socklen_t client_addr_len = sizeof(client_addr);
-    int accept_fd = 0;
-    while ((accept_fd = accept(listenFd_, (struct sockaddr *)&client_addr,
-                                &client_addr_len)) > 0) {
+    socklen_t client_addr_len;
+    while (true) {
+        // 不回复503时停止accept, 把等待的连接留在内核的监听队列中
+        if (overloaded() && overloadResponse_.empty()) {
+            pauseAccept();
+            return;
+        }
+        client_addr_len = sizeof(client_addr);
+        // 直接得到非阻塞的描述符, 不会再有设置失败时泄漏描述符的问题
+        int accept_fd = accept4(listenFd_, (struct sockaddr *)&client_addr, &client_addr_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (accept_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (acceptWithSpareFd()) continue;
+                // 预留的描述符也拿不回来, ET模式下不会再通知, 由定时器稍后重试
+                pauseAccept();
+                return;
+            }
+            break;
+        }
+        // 限制服务器的最大并发连接数
+        if (accept_fd >= MAXFDS || overloaded_) {
+            shed(accept_fd);
+            continue;
+        }
+        RateLimiter &limiter = connectionLimiter_;
+        if (limiter.enabled() && !limiter.allow(client_addr.sin_addr.s_addr, monotonicMicros())) {
+            metricAdd(M_RATE_LIMITED_CONNECTIONS, 1);
+            reject(accept_fd, kTooManyRequestsResponse);
+            continue;
+        }
         EventLoop *loop = eventLoopThreadPool_->getNextLoop();
         LOG << "New connection from " << inet_ntoa(client_addr.sin_addr) << ":"
             << ntohs(client_addr.sin_port);
-        // cout << "new connection" << endl;
-        // cout << inet_ntoa(client_addr.sin_addr) << endl;
-        // cout << ntohs(client_addr.sin_port) << endl;
         /*
         // TCP的保活机制默认是关闭的
         int optval = 0;
@@ -52,24 +152,103 @@ void Server::handNewConn() {
         getsockopt(accept_fd, SOL_SOCKET,  SO_KEEPALIVE, &optval, &len_optval);
         cout << "optval ==" << optval << endl;
         */
-        // 限制服务器的最大并发连接数
-        if (accept_fd >= MAXFDS) {
-            close(accept_fd);
-            continue;
-        }
-        // 设为非阻塞模式
-        if (setSocketNonBlocking(accept_fd) < 0) {
-            LOG << "Set non block failed!";
-            // perror("Set non block failed!");
-            return;
-        }
-
         setSocketNodelay(accept_fd);
         // setSocketNoLinger(accept_fd);
 
-        std::shared_ptr<HttpData> req_info(new HttpData(loop, accept_fd));
-        req_info->getChannel()->setHolder(req_info);
-        loop->queueInLoop(std::bind(&HttpData::newEvent, req_info));
+        // 连接在IO线程中创建, 引用计数只在该线程中修改
+        loop->queueInLoop(std::bind(&HttpData::create, loop, accept_fd, client_addr.sin_addr.s_addr,
+                                    &router_, &options_));
     }
     acceptChannel_->setEvents(EPOLLIN | EPOLLET);
-}
\ No newline at end of file
+}
+
+// 连接数或IO线程的负载超过上限时进入过载, 都降到恢复线以下才退出
+bool Server::overloaded() {
+    int connections = HttpData::connectionCount();
+    int load = 0;
+    for (EventLoop *loop : eventLoopThreadPool_->getAllLoops())
+        load = std::max(load, loop->loadUs());
+    int maxConnections = options_.maxConnections;
+    int maxLoad = options_.overloadLatencyUs;
+    if (!overloaded_) {
+        if ((maxConnections > 0 && connections >= maxConnections) ||
+            (maxLoad > 0 && load >= maxLoad)) {
+            overloaded_ = true;
+            LOG << "Overloaded: " << connections << " connections, loop load " << load << "us";
+        }
+    } else if ((maxConnections <= 0 || connections < maxConnections * 9LL / 10) &&
+               (maxLoad <= 0 || load < maxLoad / 2)) {
+        overloaded_ = false;
+        LOG << "Overload cleared: " << connections << " connections, loop load " << load << "us";
+    }
+    return overloaded_;
+}
+
+void Server::pauseAccept() {
+    if (acceptPaused_) return;
+    acceptPaused_ = true;
+    metricAdd(M_ACCEPT_PAUSED, 1);
+    // 返回后handThisConn以空的事件更新监听描述符
+    acceptChannel_->setEvents(0);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    spec.it_value.tv_nsec = OVERLOAD_CHECK_INTERVAL * 1000 * 1000;
+    spec.it_interval = spec.it_value;
+    timerfd_settime(timerFd_, 0, &spec, NULL);
+    timerChannel_->setEvents(EPOLLIN | EPOLLET);
+    loop_->updatePoller(timerChannel_.get());
+}
+
+// 重新关注监听描述符, EPOLL_CTL_MOD时队列中已有的连接会立即触发可读
+void Server::resumeAccept() {
+    acceptPaused_ = false;
+    metricAdd(M_ACCEPT_PAUSED, -1);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    timerfd_settime(timerFd_, 0, &spec, NULL);
+    acceptChannel_->setEvents(EPOLLIN | EPOLLET);
+    loop_->updatePoller(acceptChannel_.get());
+}
+
+void Server::handleOverloadTimer() {
+    uint64_t expirations;
+    ssize_t n = read(timerFd_, &expirations, sizeof expirations);
+    (void)n;
+    if (acceptPaused_ && !overloaded()) {
+        resumeAccept();
+        return;
+    }
+    // 返回后timerChannel_的连接回调按这里的事件更新
+    if (acceptPaused_) timerChannel_->setEvents(EPOLLIN | EPOLLET);
+}
+
+// 描述符用完时accept失败, 连接一直留在监听队列中. 先关掉预留的描述符, 接受并拒绝一个连接后再预留
+bool Server::acceptWithSpareFd() {
+    if (idleFd_ < 0) idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (idleFd_ < 0) return false;
+    close(idleFd_);
+    int fd = accept4(listenFd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    int saved = errno;
+    if (fd >= 0) shed(fd);
+    idleFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    // 队列已经空了(EAGAIN)由外层的accept发现
+    if (fd < 0 && saved != EAGAIN) {
+        LOG << "Accept with spare fd failed: " << strerror(saved);
+        return false;
+    }
+    return true;
+}
+
+void Server::shed(int fd) {
+    reject(fd, overloadResponse_);
+    metricAdd(M_CONNECTIONS_SHED, 1);
+}
+
+// 不读请求, 尽力发出预先生成的响应(可以为空)后关闭
+void Server::reject(int fd, std::string_view response) {
+    if (!response.empty()) {
+        ssize_t n = send(fd, response.data(), response.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        (void)n;
+    }
+    close(fd);
+}
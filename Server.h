@@ -3,23 +3,61 @@
 #include "Channel.h"
 #include "EventLoop.h"
 #include "EventLoopThreadPool.h"
+#include "FileLoader.h"
+#include "HttpOptions.h"
+#include "RateLimiter.h"
+#include "Router.h"
 
 class Server {
 public:
     Server(EventLoop *loop, int threadNum, int port);
-    ~Server() {}
+    ~Server();
     EventLoop *getLoop() const { return loop_; }
+    // 只能在start之前调用, 模式的写法见Router
+    bool addRoute(HttpMethod method, std::string_view pattern, RouteHandler handler);
+    // body分段交给handler返回的BodySink, 不整体缓存, 用于上传等大的body
+    bool addStreamRoute(HttpMethod method, std::string_view pattern, StreamHandler handler);
+    // 只能在start之前调用
+    void setOptions(const HttpOptions &options);
+    const HttpOptions &options() const { return options_; }
     void start();
     void handNewConn();
-    void handThisConn() { loop_->updatePoller(acceptChannel_); }
+    void handThisConn() { loop_->updatePoller(acceptChannel_.get()); }
 
 private:
+    // handleEvents按类型直接调用下面的处理函数
+    friend class Channel;
+
+    bool overloaded();
+    void pauseAccept();
+    void resumeAccept();
+    void handleOverloadTimer();
+    void handleTimerConn() { loop_->updatePoller(timerChannel_.get()); }
+    bool acceptWithSpareFd();
+    void shed(int fd);
+    static void reject(int fd, std::string_view response);
+
     EventLoop *loop_;
     int threadNum_;
     std::unique_ptr<EventLoopThreadPool> eventLoopThreadPool_;
+    // 在线程池之后声明, 先于IO线程析构, 不会再向已经退出的loop投递结果
+    std::unique_ptr<FileLoader> fileLoader_;
     bool started_;
-    std::shared_ptr<Channel> acceptChannel_;
+    std::unique_ptr<Channel> acceptChannel_;
     int port_;
     int listenFd_;
+    // 预留的描述符, 描述符用完(EMFILE)时关掉它来接受并拒绝等待中的连接
+    int idleFd_;
+    // 停止accept期间定时检查是否可以恢复
+    int timerFd_;
+    std::unique_ptr<Channel> timerChannel_;
+    bool overloaded_;
+    bool acceptPaused_;
+    // 过载时回复的503, start()时按overloadRetryAfter生成
+    std::string overloadResponse_;
+    // 新连接的限流, 只在主线程使用; 单线程配置中主线程的EventLoop还要用它自己的限制请求
+    RateLimiter connectionLimiter_;
+    Router router_;
+    HttpOptions options_;
     static const int MAXFDS = 100000;
 };
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "SimdScan.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+namespace {
+// RFC 7230 tchar
+struct TokenTable {
+    bool isToken[256];
+    TokenTable() {
+        memset(isToken, 0, sizeof isToken);
+        for (int c = '0'; c <= '9'; ++c) isToken[c] = true;
+        for (int c = 'a'; c <= 'z'; ++c) isToken[c] = true;
+        for (int c = 'A'; c <= 'Z'; ++c) isToken[c] = true;
+        for (const char *p = "!#$%&'*+-.^_`|~"; *p; ++p) isToken[(unsigned char)*p] = true;
+    }
+};
+const TokenTable kTokenTable;
+
+inline bool isCtl(unsigned char c) { return (c < 0x20 && c != '\t') || c == 0x7f; }
+
+// ---------------- 标量实现 ----------------
+const char *scalarFindChar(const char *p, const char *end, char c) {
+    const void *ret = memchr(p, c, end - p);
+    return ret ? static_cast<const char *>(ret) : end;
+}
+
+const char *scalarSkipToken(const char *p, const char *end) {
+    while (p != end && kTokenTable.isToken[(unsigned char)*p]) ++p;
+    return p;
+}
+
+// 每次取8字节判断是否有<0x20或等于0x7f的字节(SWAR), 有时才逐字节确认;
+// HTAB也会命中, 确认后继续向后扫描. 头部值占请求的大部分, 逐字节判断比原来的状态机还慢
+const char *scalarFindCtl(const char *p, const char *end) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    for (; end - p >= 8; p += 8) {
+        uint64_t x;
+        memcpy(&x, p, 8);
+        uint64_t del = x ^ (ones * 0x7f);
+        if ((((x - ones * 0x20) & ~x) | ((del - ones) & ~del)) & highs) {
+            for (int i = 0; i < 8; ++i)
+                if (isCtl((unsigned char)p[i])) return p + i;
+        }
+    }
+    while (p != end && !isCtl((unsigned char)*p)) ++p;
+    return p;
+}
+
+const ScanKernels kScalar = {"scalar", scalarFindChar, scalarSkipToken, scalarFindCtl};
+
+#ifdef SCAN_HAVE_X86
+// ---------------- SSE4.2, 每次16字节 ----------------
+__attribute__((target("sse4.2"))) const char *sse42FindChar(const char *p, const char *end,
+                                                             char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scalarFindChar(p, end, c);
+}
+
+// 非tchar的范围(超过8个区间, 所以把'|'和'~'也算进"{\xff", 命中后再查表确认)
+__attribute__((target("sse4.2"))) const char *sse42SkipToken(const char *p, const char *end) {
+    static const char ranges[16] = {'\x00', ' ', '"', '"', '(', ')', ',', ',',
+                                    '/', '/', ':', '@', '[', ']', '{', '\xff'};
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ranges));
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int idx = _mm_cmpestri(r, 16, v, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx == 16) {
+            p += 16;
+            continue;
+        }
+        p += idx;
+        if (!kTokenTable.isToken[(unsigned char)*p]) return p;
+        ++p;
+    }
+    return scalarSkipToken(p, end);
+}
+
+__attribute__((target("sse4.2"))) const char *sse42FindCtl(const char *p, const char *end) {
+    static const char ranges[16] = {'\x00', '\x08', '\x0a', '\x1f', '\x7f', '\x7f'};
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ranges));
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int idx = _mm_cmpestri(r, 6, v, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16) return p + idx;
+    }
+    return scalarFindCtl(p, end);
+}
+
+const ScanKernels kSse42 = {"sse4.2", sse42FindChar, sse42SkipToken, sse42FindCtl};
+
+// ---------------- AVX2, 每次32字节, 不足32字节的尾部交给SSE4.2 ----------------
+// tchar集合用高低半字节两张表判断: 低半字节表的第i位表示高半字节为i+2时是否属于集合
+struct NibbleTables {
+    uint8_t lo[32];
+    uint8_t hi[32];
+    NibbleTables() {
+        memset(lo, 0, sizeof lo);
+        memset(hi, 0, sizeof hi);
+        for (int c = 0; c < 128; ++c) {
+            if (!kTokenTable.isToken[c]) continue;
+            int bit = (c >> 4) - 2;  // tchar的高半字节只有2~7
+            lo[c & 0x0f] |= 1 << bit;
+            lo[16 + (c & 0x0f)] |= 1 << bit;
+        }
+        for (int h = 2; h <= 7; ++h) hi[h] = hi[16 + h] = 1 << (h - 2);
+    }
+};
+const NibbleTables kNibbleTables;
+
+__attribute__((target("avx2"))) const char *avx2FindChar(const char *p, const char *end,
+                                                          char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    // 进入非VEX编码的SSE代码前清掉ymm高位, 避免状态切换的开销
+    _mm256_zeroupper();
+    return sse42FindChar(p, end, c);
+}
+
+__attribute__((target("avx2"))) const char *avx2SkipToken(const char *p, const char *end) {
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kNibbleTables.lo));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(kNibbleTables.hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        // 最高位为1时pshufb结果为0, 所以>=0x80的字节自然不属于集合
+        __m256i l = _mm256_shuffle_epi8(lo, v);
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i in = _mm256_and_si256(l, h);
+        unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(in, _mm256_setzero_si256()));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    // 进入非VEX编码的SSE代码前清掉ymm高位, 避免状态切换的开销
+    _mm256_zeroupper();
+    return sse42SkipToken(p, end);
+}
+
+__attribute__((target("avx2"))) const char *avx2FindCtl(const char *p, const char *end) {
+    const __m256i x1f = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        // 无符号v <= 0x1f 等价于 max(v, 0x1f) == 0x1f
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, x1f), x1f);
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = _mm256_movemask_epi8(ctl);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    // 进入非VEX编码的SSE代码前清掉ymm高位, 避免状态切换的开销
+    _mm256_zeroupper();
+    return sse42FindCtl(p, end);
+}
+
+const ScanKernels kAvx2 = {"avx2", avx2FindChar, avx2SkipToken, avx2FindCtl};
+#endif
+
+ScanLevel detectLevel() {
+#ifdef SCAN_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return SCAN_SSE42;
+#endif
+    return SCAN_SCALAR;
+}
+}
+
+// 静态初始化之前也可以安全使用标量实现
+const ScanKernels *g_scanKernels = &kScalar;
+static ScanLevel s_level = SCAN_SCALAR;
+
+namespace {
+struct KernelSelector {
+    KernelSelector() {
+        s_level = detectLevel();
+        g_scanKernels = scanKernels(s_level);
+    }
+};
+const KernelSelector kKernelSelector;
+}
+
+ScanLevel scanLevel() { return s_level; }
+
+const ScanKernels *scanKernels(ScanLevel level) {
+    if (level > s_level) return NULL;
+    switch (level) {
+#ifdef SCAN_HAVE_X86
+    case SCAN_AVX2:
+        return &kAvx2;
+    case SCAN_SSE42:
+        return &kSse42;
+#endif
+    default:
+        return &kScalar;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+
+// 解析请求时用到的字符扫描, 启动时根据CPUID选择AVX2/SSE4.2/标量实现
+// 每个函数返回[p, end)中第一个满足条件的位置, 没有时返回end
+struct ScanKernels {
+    const char *name;
+    const char *(*findChar)(const char *p, const char *end, char c);
+    // 第一个不是tchar(RFC 7230)的字节, 用于方法和头部名
+    const char *(*skipToken)(const char *p, const char *end);
+    // 第一个除HTAB以外的控制字符, 用于头部值
+    const char *(*findCtl)(const char *p, const char *end);
+};
+
+enum ScanLevel { SCAN_SCALAR = 0, SCAN_SSE42, SCAN_AVX2 };
+
+// 当前CPU支持的最高级别
+ScanLevel scanLevel();
+// 指定级别的实现, CPU不支持时返回NULL, 供测试和基准使用
+const ScanKernels *scanKernels(ScanLevel level);
+
+extern const ScanKernels *g_scanKernels;
+
+inline const char *scanFindChar(const char *p, const char *end, char c) {
+    return g_scanKernels->findChar(p, end, c);
+}
+inline const char *scanSkipToken(const char *p, const char *end) {
+    return g_scanKernels->skipToken(p, end);
+}
+inline const char *scanFindCtl(const char *p, const char *end) {
+    return g_scanKernels->findCtl(p, end);
+}
@@ -1,36 +1,23 @@
 #include "Timer.h"
-#include <sys/time.h>
 #include <unistd.h>
 #include <queue>
+#include "Util.h"
 
-TimerNode::TimerNode(std::shared_ptr<HttpData> requestData, int timeout)
-    : deleted_(false), SPHttpData(requestData) {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    // 以毫秒计
-    expiredTime_ =
-        (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000)) + timeout;
-}
+// 以毫秒计
+static int64_t nowMs() { return monotonicMicros() / 1000; }
+
+TimerNode::TimerNode(HttpData *requestData, int timeout)
+    : deleted_(false), expiredTime_(nowMs() + timeout), conn_(requestData) {}
 
+// 还没有解除关联说明连接在期限内没有新的事件; handleTimeout返回后才释放引用
 TimerNode::~TimerNode() {
-    if (SPHttpData) SPHttpData->handleClose();
+    if (conn_) conn_->handleTimeout();
 }
 
-TimerNode::TimerNode(TimerNode &tn)
-    : SPHttpData(tn.SPHttpData), expiredTime_(0) {}
-
-void TimerNode::update(int timeout) {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    expiredTime_ =
-        (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000)) + timeout;
-}
+void TimerNode::update(int timeout) { expiredTime_ = nowMs() + timeout; }
 
 bool TimerNode::isValid() {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    size_t temp = (((now.tv_sec % 10000) * 1000) + (now.tv_usec / 1000));
-    if (temp < expiredTime_)
+    if (nowMs() < expiredTime_)
         return true;
     else {
         this->setDeleted();
@@ -39,27 +26,43 @@ bool TimerNode::isValid() {
 }
 
 void TimerNode::clearReq() {
-    SPHttpData.reset();
     this->setDeleted();
+    conn_.reset();
 }
 
 TimerManager::TimerManager() {}
 
-TimerManager::~TimerManager() {}
+TimerManager::~TimerManager() {
+    while (!timerNodeQueue.empty()) popAndDelete();
+}
+
+void TimerManager::popAndDelete() {
+    TimerNode *node = timerNodeQueue.top();
+    timerNodeQueue.pop();
+    delete node;
+}
+
+void TimerManager::addTimer(HttpData *conn, int timeout) {
+    TimerNode *node = new TimerNode(conn, timeout);
+    conn->linkTimer(node);
+    timerNodeQueue.push(node);
+}
 
-void TimerManager::addTimer(std::shared_ptr<HttpData> SPHttpData, int timeout) {
-    SPTimerNode new_node(new TimerNode(SPHttpData, timeout));
-    timerNodeQueue.push(new_node);
-    SPHttpData->linkTimer(new_node);
+int TimerManager::nextTimeout(int limit) {
+    while (!timerNodeQueue.empty() && timerNodeQueue.top()->isDeleted()) popAndDelete();
+    if (timerNodeQueue.empty()) return limit;
+    int64_t left = timerNodeQueue.top()->getExpTime() - nowMs();
+    if (left <= 0) return 0;
+    return left < limit ? static_cast<int>(left) : limit;
 }
 
 void TimerManager::handleExpiredEvent() {
     while (!timerNodeQueue.empty()) {
-        SPTimerNode ptimer_now = timerNodeQueue.top();
+        TimerNode *ptimer_now = timerNodeQueue.top();
         if (ptimer_now->isDeleted())
-        timerNodeQueue.pop();
+        popAndDelete();
         else if (ptimer_now->isValid() == false)
-        timerNodeQueue.pop();
+        popAndDelete();
         else
         break;
     }
@@ -1,49 +1,55 @@
 #pragma once
+#include <stdint.h>
 #include <unistd.h>
 #include <deque>
 #include <memory>
 #include <queue>
+#include <vector>
 #include "HttpData.h"
 #include "MutexLock.h"
+#include "Ref.h"
 #include "noncopyable.h"
 
 
 class HttpData;
 
-class TimerNode {
+// 定时器节点只属于TimerManager的堆, 持有连接的一个引用, 连接用timer_指回它;
+// 连接收到事件时clearReq解除关联(节点留在堆中, 到期或到堆顶时删除), 未解除就到期时调用handleTimeout
+class TimerNode : noncopyable {
 public:
-    TimerNode(std::shared_ptr<HttpData> requestData, int timeout);
+    TimerNode(HttpData *requestData, int timeout);
     ~TimerNode();
-    TimerNode(TimerNode &tn);
     void update(int timeout);
     bool isValid();
     void clearReq();
     void setDeleted() { deleted_ = true; }
     bool isDeleted() const { return deleted_; }
-    size_t getExpTime() const { return expiredTime_; }
+    int64_t getExpTime() const { return expiredTime_; }
 
 private:
     bool deleted_;
-    size_t expiredTime_;
-    std::shared_ptr<HttpData> SPHttpData;
+    // CLOCK_MONOTONIC的毫秒数, 不回绕, 也不受系统时间调整的影响
+    int64_t expiredTime_;
+    Ref<HttpData> conn_;
 };
 
 struct TimerCmp {
-    bool operator()(std::shared_ptr<TimerNode> &a,
-                    std::shared_ptr<TimerNode> &b) const {
+    bool operator()(const TimerNode *a, const TimerNode *b) const {
         return a->getExpTime() > b->getExpTime();
     }
 };
 
-class TimerManager {
+class TimerManager : noncopyable {
 public:
     TimerManager();
     ~TimerManager();
-    void addTimer(std::shared_ptr<HttpData> SPHttpData, int timeout);
+    void addTimer(HttpData *conn, int timeout);
     void handleExpiredEvent();
+    // 距离最早的定时器到期的毫秒数, 没有定时器时返回limit
+    int nextTimeout(int limit);
 
 private:
-    typedef std::shared_ptr<TimerNode> SPTimerNode;
-    std::priority_queue<SPTimerNode, std::deque<SPTimerNode>, TimerCmp>
-        timerNodeQueue;
+    // 节点属于堆, 先出堆再删除, 节点的析构(handleTimeout)中可以再添加定时器
+    void popAndDelete();
+    std::priority_queue<TimerNode *, std::vector<TimerNode *>, TimerCmp> timerNodeQueue;
 };
\ No newline at end of file
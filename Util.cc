@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -34,12 +35,13 @@ ssize_t readn(int fd, void *buff, size_t n) {
     return readSum;
 }
 
-ssize_t readn(int fd, std::string &inBuffer, bool &zero) {
+ssize_t readn(int fd, std::string &inBuffer, bool &zero, size_t limit) {
     ssize_t nread = 0;
     ssize_t readSum = 0;
-    while (true) {
+    while (static_cast<size_t>(readSum) < limit) {
         char buff[MAX_BUFF];
-        if ((nread = read(fd, buff, MAX_BUFF)) < 0) {
+        size_t want = limit - readSum < MAX_BUFF ? limit - readSum : MAX_BUFF;
+        if ((nread = read(fd, buff, want)) < 0) {
         if (errno == EINTR)
             continue;
         else if (errno == EAGAIN) {
@@ -49,16 +51,11 @@ ssize_t readn(int fd, std::string &inBuffer, bool &zero) {
             return -1;
         }
         } else if (nread == 0) {
-        // printf("redsum = %d\n", readSum);
             zero = true;
             break;
         }
-        // printf("before inBuffer.size() = %d\n", inBuffer.size());
-        // printf("nread = %d\n", nread);
         readSum += nread;
-        // buff += nread;
-        inBuffer += std::string(buff, buff + nread);
-        // printf("after inBuffer.size() = %d\n", inBuffer.size());
+        inBuffer.append(buff, nread);
     }
     return readSum;
 }
@@ -218,4 +215,17 @@ int socket_bind_listen(int port) {
         return -1;
     }
     return listen_fd;
-}
\ No newline at end of file
+}
+
+int64_t monotonicMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t stringHeapBytes(const std::string &s) {
+    const char *p = s.data();
+    const char *self = reinterpret_cast<const char *>(&s);
+    if (p >= self && p < self + sizeof s) return 0;
+    return s.capacity() + 1;
+}
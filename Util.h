@@ -1,9 +1,11 @@
 #pragma once
+#include <stdint.h>
 #include <cstdlib>
 #include <string>
 
 ssize_t readn(int fd, void *buff, size_t n);
-ssize_t readn(int fd, std::string &inBuffer, bool &zero);
+// 读到EAGAIN, 对端关闭(zero置为true)或已读limit字节为止
+ssize_t readn(int fd, std::string &inBuffer, bool &zero, size_t limit = SIZE_MAX);
 ssize_t readn(int fd, std::string &inBuffer);
 ssize_t writen(int fd, void *buff, size_t n);
 ssize_t writen(int fd, std::string &sbuff);
@@ -12,4 +14,8 @@ int setSocketNonBlocking(int fd);
 void setSocketNodelay(int fd);
 void setSocketNoLinger(int fd);
 void shutDownWR(int fd);
-int socket_bind_listen(int port);
\ No newline at end of file
+int socket_bind_listen(int port);
+// CLOCK_MONOTONIC, 微秒
+int64_t monotonicMicros();
+// 字符串在堆上占用的字节数, 短字符串存放在对象内部时为0
+size_t stringHeapBytes(const std::string &s);
\ No newline at end of file